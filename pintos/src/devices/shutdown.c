@@ -5,6 +5,7 @@
 #include "devices/serial.h"
 #include "devices/timer.h"
 #include "threads/io.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
@@ -12,6 +13,10 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#endif
+#ifdef P4FILESYS
+#include "filesys/cache.h"
 #endif
 
 /* Keyboard control register port. */
@@ -128,8 +133,13 @@ print_stats (void)
 {
   timer_print_stats ();
   thread_print_stats ();
+  palloc_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
+  free_map_print_stats ();
+#endif
+#ifdef P4FILESYS
+  cache_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
@@ -0,0 +1,452 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+
+#ifdef P4FILESYS
+//the buffer cache: buffer_size slots allocated once, found by sector through
+//a hash table of chained slots. Each bucket has a lock of its own, which
+//covers the chain and the reference counts of its slots, so lookups of
+//different sectors rarely meet. A slot's own lock is held while its data is
+//read from disk or used. Slots are reused by a clock over the array, which
+//skips slots in use and gives accessed ones a second chance.
+//
+//A flusher thread writes dirty sectors back every FLUSH_TICKS, or sooner
+//once more than FLUSH_DIRTY_PCT percent of the slots are dirty, so that
+//eviction seldom has to write on the path of a reader. It looks every
+//FLUSH_TICKS / FLUSH_CHECKS ticks, and writes in sector order, so runs of
+//adjacent sectors go out one after the other.
+#define FLUSH_TICKS TIMER_FREQ
+#define FLUSH_CHECKS 10
+#define FLUSH_DIRTY_PCT 50
+
+//A readahead thread reads the sectors queued by cache_readahead(), up to
+//READAHEAD_QUEUE at a time, into slots marked prefetched. They get no second
+//chance from the clock until they are used, so eviction takes a sector read
+//ahead for nothing before one that was asked for.
+#define READAHEAD_QUEUE 64
+struct cache_bucket
+{
+	struct lock lock;
+	struct cache_slot *head;
+};
+
+static struct cache_slot *slots;
+static struct cache_bucket *buckets;
+static size_t bucket_cnt; //a power of 2, at least buffer_size
+static struct lock clock_lock; //the clock hand
+static size_t clock_hand;
+
+static long long hit_cnt; //lookups that found their sector
+static long long miss_cnt; //lookups that took a slot for it
+static long long evict_cnt; //valid slots reused
+static long long write_cnt; //dirty sectors written back
+static long long flush_cnt; //flushes by the flusher thread
+static long long flush_sector_cnt; //sectors they wrote
+static long long flush_run_cnt; //runs of adjacent sectors among those
+
+static long long ra_cnt; //sectors read ahead
+static long long ra_hit_cnt; //of those, used afterwards
+static long long ra_waste_cnt; //of those, evicted unused
+static long long ra_drop_cnt; //sectors not read ahead, the queue was full
+
+static block_sector_t ra_queue[READAHEAD_QUEUE]; //ring of sectors to read
+static size_t ra_head, ra_cnt_queued; //first sector of the ring, sectors
+static struct lock ra_lock; //the ring
+static struct semaphore ra_sema; //upped for each sector queued
+
+static size_t dirty_cnt; //dirty slots
+static struct cache_slot **flush_list; //dirty slots of a flush, sorted
+
+static struct cache_bucket *sector_bucket(block_sector_t sector);
+static struct cache_slot *slot_get(block_sector_t sector, bool fill,
+		bool *hit);
+static struct cache_slot *cache_evict(void);
+static void readahead(void *aux);
+static void set_dirty(struct cache_slot *s, bool dirty);
+static void flusher(void *aux);
+static void flush_dirty(void);
+static int sector_cmp(const void *a, const void *b);
+
+//allocates the slots and the hash table, for buffer_size sectors
+void cache_init(void)
+{
+	size_t i;
+
+	if (buffer_size == 0)
+		buffer_size = BUFFER_SIZE;
+	for (bucket_cnt = 1; bucket_cnt < buffer_size; bucket_cnt *= 2)
+		continue;
+	slots = malloc(buffer_size * sizeof *slots);
+	buckets = malloc(bucket_cnt * sizeof *buckets);
+	flush_list = malloc(buffer_size * sizeof *flush_list);
+	if (slots == NULL || buckets == NULL || flush_list == NULL)
+		PANIC("no memory for a buffer cache of %u sectors", buffer_size);
+
+	for (i = 0; i < buffer_size; i++)
+	{
+		slots[i].valid = slots[i].dirty = slots[i].accessed = false;
+		slots[i].prefetched = false;
+		slots[i].refs = 0;
+		lock_init(&slots[i].lock);
+		slots[i].next = NULL;
+	}
+	for (i = 0; i < bucket_cnt; i++)
+	{
+		lock_init(&buckets[i].lock);
+		buckets[i].head = NULL;
+	}
+	lock_init(&clock_lock);
+	clock_hand = 0;
+	lock_init(&ra_lock);
+	sema_init(&ra_sema, 0);
+	thread_create("flusher", PRI_DEFAULT, flusher, NULL);
+	thread_create("readahead", PRI_DEFAULT, readahead, NULL);
+}
+
+static struct cache_bucket *sector_bucket(block_sector_t sector)
+{
+	return &buckets[(sector * 2654435761u) & (bucket_cnt - 1)];
+}
+
+//returns the slot holding SECTOR, with its lock held. The sector is read
+//from disk on a miss if FILL, else the caller overwrites all of it. Never
+//fails: with every slot in use, it waits for one to be put back.
+struct cache_slot *cache_get(block_sector_t sector, bool fill)
+{
+	bool hit;
+	struct cache_slot *s = slot_get(sector, fill, &hit);
+
+	if (!hit)
+		miss_cnt++;
+	else
+		hit_cnt++;
+	if (hit && s->prefetched)
+	{
+		s->prefetched = false;
+		ra_hit_cnt++;
+	}
+	return s;
+}
+
+//does the work of cache_get(), and sets HIT if SECTOR was in the cache
+static struct cache_slot *slot_get(block_sector_t sector, bool fill,
+		bool *hit)
+{
+	struct cache_bucket *b = sector_bucket(sector);
+	struct cache_slot *s, *free_slot = NULL;
+
+	for (;;)
+	{
+		lock_acquire(&b->lock);
+		for (s = b->head; s != NULL; s = s->next)
+			if (s->sector == sector)
+				break;
+		if (s != NULL || free_slot != NULL)
+			break;
+		lock_release(&b->lock);
+
+		//the disk write of a victim must not hold up the bucket
+		free_slot = cache_evict();
+	}
+
+	if (s != NULL)
+	{
+		//found, maybe after another thread took a slot for it meanwhile
+		s->refs++;
+		lock_release(&b->lock);
+		if (free_slot != NULL)
+			free_slot->refs = 0;
+		*hit = true;
+		lock_acquire(&s->lock);
+		return s;
+	}
+
+	s = free_slot;
+	s->sector = sector;
+	s->valid = true;
+	s->dirty = false;
+	s->prefetched = false;
+	s->refs = 1;
+	s->next = b->head;
+	b->head = s;
+	lock_acquire(&s->lock);
+	lock_release(&b->lock);
+	*hit = false;
+	if (fill)
+		block_read(fs_device, sector, s->data);
+	return s;
+}
+
+//puts back SLOT, got from cache_get(), whose data was changed if DIRTY
+void cache_put(struct cache_slot *s, bool dirty)
+{
+	struct cache_bucket *b = sector_bucket(s->sector);
+
+	if (dirty)
+		set_dirty(s, true);
+	s->accessed = true;
+	lock_release(&s->lock);
+	lock_acquire(&b->lock);
+	s->refs--;
+	lock_release(&b->lock);
+}
+
+//takes a slot nobody uses off the hash table, writing it back if dirty, and
+//returns it with a reference for the caller
+static struct cache_slot *cache_evict(void)
+{
+	struct cache_slot *s;
+	size_t n;
+
+	lock_acquire(&clock_lock);
+	for (n = 0;; n++)
+	{
+		struct cache_bucket *b;
+		struct cache_slot **p;
+
+		//all in use for two turns of the hand
+		if (n == 2 * buffer_size)
+		{
+			lock_release(&clock_lock);
+			thread_yield();
+			lock_acquire(&clock_lock);
+			n = 0;
+		}
+		s = &slots[clock_hand];
+		clock_hand = (clock_hand + 1) % buffer_size;
+
+		//a free slot is only ever taken under the clock lock
+		if (!s->valid && s->refs == 0)
+			break;
+		if (!s->valid)
+			continue;
+		b = sector_bucket(s->sector);
+		lock_acquire(&b->lock);
+		if (s->refs > 0 || s->accessed)
+		{
+			s->accessed = false;
+			lock_release(&b->lock);
+			continue;
+		}
+		if (s->prefetched)
+			ra_waste_cnt++;
+
+		//written with the bucket held, so nobody reads the sector from disk
+		//before the write is done
+		if (s->dirty)
+		{
+			block_write(fs_device, s->sector, s->data);
+			set_dirty(s, false);
+			write_cnt++;
+		}
+		for (p = &b->head; *p != s; p = &(*p)->next)
+			continue;
+		*p = s->next;
+		s->valid = false;
+		lock_release(&b->lock);
+		evict_cnt++;
+		break;
+	}
+	s->refs = 1;
+	lock_release(&clock_lock);
+	return s;
+}
+
+//copies SIZE bytes at OFS of SECTOR to BUFFER
+void cache_read(block_sector_t sector, void *buffer, int ofs, int size)
+{
+	struct cache_slot *s = cache_get(sector, true);
+
+	memcpy(buffer, s->data + ofs, size);
+	cache_put(s, false);
+}
+
+//copies SIZE bytes of BUFFER to OFS of SECTOR. A whole sector is not read
+//from disk first.
+void cache_write(block_sector_t sector, const void *buffer, int ofs,
+		int size)
+{
+	struct cache_slot *s = cache_get(sector,
+			ofs != 0 || size != BLOCK_SECTOR_SIZE);
+
+	memcpy(s->data + ofs, buffer, size);
+	cache_put(s, true);
+}
+
+//queues SECTOR to be read into the cache by the readahead thread, unless
+//the queue is full
+void cache_readahead(block_sector_t sector)
+{
+	lock_acquire(&ra_lock);
+	if (ra_cnt_queued == READAHEAD_QUEUE)
+	{
+		lock_release(&ra_lock);
+		ra_drop_cnt++;
+		return;
+	}
+	ra_queue[(ra_head + ra_cnt_queued++) % READAHEAD_QUEUE] = sector;
+	lock_release(&ra_lock);
+	sema_up(&ra_sema);
+}
+
+//the readahead thread. A sector already cached is left as it is, else it
+//is read into a slot that is put back without being marked accessed.
+static void readahead(void *aux UNUSED)
+{
+	for (;;)
+	{
+		block_sector_t sector;
+		struct cache_bucket *b;
+		struct cache_slot *s;
+		bool hit;
+
+		sema_down(&ra_sema);
+		lock_acquire(&ra_lock);
+		sector = ra_queue[ra_head];
+		ra_head = (ra_head + 1) % READAHEAD_QUEUE;
+		ra_cnt_queued--;
+		lock_release(&ra_lock);
+
+		s = slot_get(sector, true, &hit);
+		if (!hit)
+		{
+			s->prefetched = true;
+			ra_cnt++;
+		}
+		lock_release(&s->lock);
+		b = sector_bucket(sector);
+		lock_acquire(&b->lock);
+		s->refs--;
+		lock_release(&b->lock);
+	}
+}
+
+//writes every dirty sector back to disk, at shutdown
+void cache_flush(void)
+{
+	size_t i;
+
+	for (i = 0; i < buffer_size; i++)
+	{
+		struct cache_slot *s = &slots[i];
+
+		lock_acquire(&s->lock);
+		if (s->valid && s->dirty)
+		{
+			block_write(fs_device, s->sector, s->data);
+			set_dirty(s, false);
+			write_cnt++;
+		}
+		lock_release(&s->lock);
+	}
+}
+
+//marks the slot S dirty or clean, keeping count of the dirty slots
+static void set_dirty(struct cache_slot *s, bool dirty)
+{
+	enum intr_level old_level;
+
+	if (s->dirty == dirty)
+		return;
+	s->dirty = dirty;
+	old_level = intr_disable();
+	if (dirty)
+		dirty_cnt++;
+	else
+		dirty_cnt--;
+	intr_set_level(old_level);
+}
+
+//the flusher thread
+static void flusher(void *aux UNUSED)
+{
+	int64_t last = timer_ticks();
+
+	for (;;)
+	{
+		timer_sleep(FLUSH_TICKS / FLUSH_CHECKS);
+		if (timer_elapsed(last) < FLUSH_TICKS
+				&& dirty_cnt * 100 <= buffer_size * FLUSH_DIRTY_PCT)
+			continue;
+		flush_dirty();
+		last = timer_ticks();
+	}
+}
+
+//writes back the slots that are dirty, in sector order
+static void flush_dirty(void)
+{
+	size_t cnt = 0, written = 0, i;
+	block_sector_t prev = 0;
+
+	//a first look without locks, each slot is checked again before its write
+	for (i = 0; i < buffer_size; i++)
+		if (slots[i].valid && slots[i].dirty)
+			flush_list[cnt++] = &slots[i];
+	if (cnt == 0)
+		return;
+	qsort(flush_list, cnt, sizeof *flush_list, sector_cmp);
+
+	for (i = 0; i < cnt; i++)
+	{
+		struct cache_slot *s = flush_list[i];
+		block_sector_t sector = s->sector;
+		struct cache_bucket *b = sector_bucket(sector);
+
+		//held by a reference, so that it is not evicted under the write
+		lock_acquire(&b->lock);
+		if (!s->valid || s->sector != sector || !s->dirty)
+		{
+			lock_release(&b->lock);
+			continue;
+		}
+		s->refs++;
+		lock_release(&b->lock);
+
+		lock_acquire(&s->lock);
+		if (s->dirty)
+		{
+			block_write(fs_device, sector, s->data);
+			set_dirty(s, false);
+			if (written++ == 0 || sector != prev + 1)
+				flush_run_cnt++;
+			prev = sector;
+		}
+		lock_release(&s->lock);
+		lock_acquire(&b->lock);
+		s->refs--;
+		lock_release(&b->lock);
+	}
+	flush_sector_cnt += written;
+	flush_cnt++;
+}
+
+static int sector_cmp(const void *a_, const void *b_)
+{
+	const struct cache_slot *a = *(struct cache_slot * const *) a_;
+	const struct cache_slot *b = *(struct cache_slot * const *) b_;
+
+	return a->sector < b->sector ? -1 : a->sector > b->sector;
+}
+
+void cache_print_stats(void)
+{
+	printf("Cache: %u sectors, %lld hits, %lld misses, %lld evictions, "
+			"%lld sectors written back\n", buffer_size, hit_cnt, miss_cnt,
+			evict_cnt, write_cnt);
+	printf("Cache: %lld flushes wrote %lld sectors in %lld runs, "
+			"%lld.%02lld sectors a flush\n", flush_cnt, flush_sector_cnt,
+			flush_run_cnt, flush_cnt ? flush_sector_cnt / flush_cnt : 0,
+			flush_cnt ? flush_sector_cnt * 100 / flush_cnt % 100 : 0);
+	printf("Cache: %lld sectors read ahead, %lld used, %lld evicted unused, "
+			"%lld not queued\n", ra_cnt, ra_hit_cnt, ra_waste_cnt,
+			ra_drop_cnt);
+}
+#endif
@@ -0,0 +1,32 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+#include "threads/synch.h"
+
+//a sector held by the buffer cache
+struct cache_slot
+{
+	block_sector_t sector; //sector held, if valid
+	bool valid; //holds SECTOR, and is in the hash table
+	bool dirty; //differs from the disk
+	bool accessed; //used since the clock hand last passed
+	bool prefetched; //read ahead, and not used yet
+	int refs; //users, the slot is not evicted while there are any
+	struct lock lock; //held by the user of the data
+	struct cache_slot *next; //next slot of the hash bucket
+	uint8_t data[BLOCK_SECTOR_SIZE];
+};
+
+void cache_init(void);
+struct cache_slot *cache_get(block_sector_t sector, bool fill);
+void cache_put(struct cache_slot *slot, bool dirty);
+void cache_read(block_sector_t sector, void *buffer, int ofs, int size);
+void cache_write(block_sector_t sector, const void *buffer, int ofs,
+		int size);
+void cache_readahead(block_sector_t sector);
+void cache_flush(void);
+void cache_print_stats(void);
+
+#endif
@@ -8,6 +8,7 @@
 #include "filesys/directory.h"
 
 #ifdef P4FILESYS
+#include "filesys/cache.h"
 #include "threads/thread.h"
 #include "threads/malloc.h"
 #endif
@@ -28,9 +29,7 @@ void filesys_init(bool format)
 	inode_init();
 
 #ifdef P4FILESYS
-	list_init(&list_buffer);
-	lock_init(&buffer_lock);
-	buffer_size = 0;
+	cache_init();
 #endif
 
 	free_map_init();
@@ -45,29 +44,11 @@ void filesys_init(bool format)
  to disk. */
 void filesys_done(void)
 {
+	free_map_close();
 #ifdef P4FILESYS
 	//before shutting down the filesys module, write all dirty data to disk
-	struct buffer_struct *bc = NULL;
-	struct list_elem *e;
-	lock_acquire(&buffer_lock);
-	for (e = list_begin(&list_buffer); e != list_end(&list_buffer); e =
-			list_next(e))
-	{
-		bc = list_entry(e, struct buffer_struct, buffer_listelem);
-		if (bc != NULL)
-		{
-			if (bc->dirty)
-				block_write(fs_device, bc->sector, &bc->content);
-		}
-		else
-			PANIC("filesys_done: NULL value of buffer encountered");
-
-		list_remove(&bc->buffer_listelem);
-	}
-	free(bc);
-	lock_release(&buffer_lock);
+	cache_flush();
 #endif
-	free_map_close();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -344,47 +325,4 @@ void filesys_filename(char** fname, char* path)
 		PANIC("Cannot allocate memory while getting filename");
 	strlcpy(*fname, file, len);
 }
-
-struct buffer_struct* buffer_evict(uint32_t sector)
-{
-	struct buffer_struct *bc = NULL;
-
-	if (buffer_size > BUFFER_SIZE)
-	{
-		for (struct list_elem *e = list_begin(&list_buffer);
-				e != list_end(&list_buffer); e = list_next(e))
-		{
-			if (list_entry(e, struct buffer_struct, buffer_listelem)->dirty
-					&& !list_entry(e, struct buffer_struct, buffer_listelem)->access)
-			{
-				bc = list_entry(e, struct buffer_struct, buffer_listelem);
-				block_write(fs_device, bc->sector, &bc->content);
-				break;
-			}
-			else if (list_entry(e, struct buffer_struct, buffer_listelem)->access)
-			{
-				list_entry(e, struct buffer_struct, buffer_listelem)->access =
-				false;
-			}
-		}
-		if (bc != NULL)
-		{
-			bc->sector = sector;
-			block_read(fs_device, bc->sector, &bc->content);
-			return bc;
-		}
-		return NULL;
-	}
-	bc = (struct buffer_struct *) malloc(sizeof(struct buffer_struct));
-	if (bc != NULL)
-	{
-		list_push_back(&list_buffer, &bc->buffer_listelem);
-		bc->sector = sector;
-		block_read(fs_device, bc->sector, &bc->content);
-		buffer_size += 1;
-		return bc;
-	}
-	return NULL;
-
-}
 #endif
@@ -14,22 +14,11 @@
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
 
 #ifdef P4FILESYS
+//sectors the buffer cache holds unless -bufsize says otherwise
 #define BUFFER_SIZE 64
 
-struct lock buffer_lock;
+//-bufsize: sectors the buffer cache holds
 uint32_t buffer_size;
-struct list list_buffer;
-
-struct buffer_struct
-{
-	bool dirty;
-	bool access;
-	uint8_t content[BLOCK_SECTOR_SIZE];
-	uint32_t sector;
-	struct list_elem buffer_listelem;
-};
-
-struct buffer_struct* buffer_evict(uint32_t sector);
 #endif
 
 /* Block device that contains the file system. */
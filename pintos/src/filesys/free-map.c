@@ -1,12 +1,70 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <tree.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+
+/* The bitmap is what is kept on disk.  Alongside it, every run
+   of free sectors is indexed twice: by start sector, to find the
+   neighbours a released run merges with, and by size, to find
+   the smallest run that satisfies an allocation.
+
+   Changes only mark the sectors of the free map file that hold
+   the changed bits, and free_map_sync() writes just those. */
+
+/* A run of free sectors. */
+struct free_run
+  {
+    block_sector_t start;         /* First free sector. */
+    size_t cnt;                   /* Number of free sectors. */
+    struct tree_elem addr_elem;   /* Element in runs_by_addr. */
+    struct tree_elem size_elem;   /* Element in runs_by_size. */
+  };
+
+/* Bits of the free map held by one sector of its file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct bitmap *dirty_map;     /* Free map file sectors to write. */
+static struct tree runs_by_addr;     /* Free runs by start sector. */
+static struct tree runs_by_size;     /* Free runs by size, then start. */
+
+static long long alloc_cnt;          /* Sectors allocated. */
+static long long release_cnt;        /* Sectors released. */
+static long long map_write_cnt;      /* Free map file sectors written. */
+
+static void build_runs (void);
+static void add_run (block_sector_t start, size_t cnt);
+static void take_run (struct free_run *, block_sector_t start, size_t cnt);
+static void mark_dirty (block_sector_t start, size_t cnt);
+
+/* Orders free runs by start sector. */
+static bool
+addr_less (const struct tree_elem *a_, const struct tree_elem *b_,
+           void *aux UNUSED)
+{
+  const struct free_run *a = tree_entry (a_, struct free_run, addr_elem);
+  const struct free_run *b = tree_entry (b_, struct free_run, addr_elem);
+
+  return a->start < b->start;
+}
+
+/* Orders free runs by size, and runs of a size by start sector. */
+static bool
+size_less (const struct tree_elem *a_, const struct tree_elem *b_,
+           void *aux UNUSED)
+{
+  const struct free_run *a = tree_entry (a_, struct free_run, size_elem);
+  const struct free_run *b = tree_entry (b_, struct free_run, size_elem);
+
+  return a->cnt < b->cnt || (a->cnt == b->cnt && a->start < b->start);
+}
 
 /* Initializes the free map. */
 void
@@ -15,29 +73,57 @@ free_map_init (void)
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  dirty_map = bitmap_create (DIV_ROUND_UP (block_size (fs_device),
+                                           BITS_PER_SECTOR));
+  if (dirty_map == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  tree_init (&runs_by_addr, addr_less, NULL);
+  tree_init (&runs_by_size, size_less, NULL);
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  build_runs ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  They are taken from the start of the
+   smallest free run that is long enough.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
-    {
-      bitmap_set_multiple (free_map, sector, cnt, false);
-      sector = BITMAP_ERROR;
-    }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  struct free_run key = {.start = 0, .cnt = cnt};
+  struct tree_elem *e;
+  struct free_run *run;
+
+  e = tree_ceiling (&runs_by_size, &key.size_elem);
+  if (e == NULL)
+    return false;
+  run = tree_entry (e, struct free_run, size_elem);
+  *sectorp = run->start;
+  take_run (run, run->start, cnt);
+  return true;
+}
+
+/* Allocates the CNT sectors starting at SECTOR, if they are all
+   free.  Lets a file grow its last run of sectors in place.
+   Returns true if successful, false if any of the sectors is in
+   use or past the end of the device. */
+bool
+free_map_allocate_at (block_sector_t sector, size_t cnt)
+{
+  struct free_run key = {.start = sector};
+  struct tree_elem *e;
+  struct free_run *run;
+
+  e = tree_floor (&runs_by_addr, &key.addr_elem);
+  if (e == NULL)
+    return false;
+  run = tree_entry (e, struct free_run, addr_elem);
+  if (run->start + run->cnt < sector + cnt)
+    return false;
+  take_run (run, sector, cnt);
+  return true;
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
@@ -46,7 +132,33 @@ free_map_release (block_sector_t sector, size_t cnt)
 {
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark_dirty (sector, cnt);
+  release_cnt += cnt;
+  add_run (sector, cnt);
+}
+
+/* Writes the sectors of the free map file whose bits changed
+   since they were last written.  They go to the buffer cache,
+   if there is one, which writes them to disk in its own time. */
+void
+free_map_sync (void)
+{
+  size_t size = bitmap_file_size (free_map);
+  size_t i;
+
+  if (free_map_file == NULL)
+    return;
+  for (i = 0; i < bitmap_size (dirty_map); i++)
+    if (bitmap_test (dirty_map, i))
+      {
+        size_t ofs = i * BLOCK_SECTOR_SIZE;
+        size_t part = size - ofs < BLOCK_SECTOR_SIZE ? size - ofs
+                                                     : BLOCK_SECTOR_SIZE;
+        if (!bitmap_write_part (free_map, free_map_file, ofs, part))
+          PANIC ("can't write free map");
+        bitmap_reset (dirty_map, i);
+        map_write_cnt++;
+      }
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,13 +170,16 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  build_runs ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void)
 {
+  free_map_sync ();
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -86,4 +201,140 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (dirty_map, false);
+}
+
+/* Prints free map statistics. */
+void
+free_map_print_stats (void)
+{
+  printf ("Free map: %lld sectors allocated, %lld released, "
+          "%lld map sectors written, %zu free runs\n",
+          alloc_cnt, release_cnt, map_write_cnt, tree_size (&runs_by_addr));
+}
+
+/* Rebuilds the free runs from the bitmap. */
+static void
+build_runs (void)
+{
+  size_t start = 0;
+
+  while (!tree_empty (&runs_by_addr))
+    {
+      struct free_run *run = tree_entry (tree_first (&runs_by_addr),
+                                         struct free_run, addr_elem);
+      tree_remove (&runs_by_addr, &run->addr_elem);
+      tree_remove (&runs_by_size, &run->size_elem);
+      free (run);
+    }
+
+  for (;;)
+    {
+      size_t end;
+
+      start = bitmap_scan (free_map, start, 1, false);
+      if (start == BITMAP_ERROR)
+        break;
+      end = bitmap_scan (free_map, start, 1, true);
+      if (end == BITMAP_ERROR)
+        end = bitmap_size (free_map);
+      add_run (start, end - start);
+      start = end;
+    }
+}
+
+/* Adds the CNT free sectors at START to the runs, merged with the
+   runs just before and after them. */
+static void
+add_run (block_sector_t start, size_t cnt)
+{
+  struct free_run key = {.start = start};
+  struct free_run *prev = NULL, *next = NULL;
+  struct tree_elem *e;
+
+  e = tree_floor (&runs_by_addr, &key.addr_elem);
+  if (e != NULL)
+    prev = tree_entry (e, struct free_run, addr_elem);
+  e = tree_ceiling (&runs_by_addr, &key.addr_elem);
+  if (e != NULL)
+    next = tree_entry (e, struct free_run, addr_elem);
+
+  if (prev != NULL && prev->start + prev->cnt == start)
+    {
+      tree_remove (&runs_by_size, &prev->size_elem);
+      prev->cnt += cnt;
+      if (next != NULL && start + cnt == next->start)
+        {
+          prev->cnt += next->cnt;
+          tree_remove (&runs_by_addr, &next->addr_elem);
+          tree_remove (&runs_by_size, &next->size_elem);
+          free (next);
+        }
+      tree_insert (&runs_by_size, &prev->size_elem);
+    }
+  else if (next != NULL && start + cnt == next->start)
+    {
+      /* The run starts earlier, which keeps its place by address. */
+      tree_remove (&runs_by_size, &next->size_elem);
+      next->start = start;
+      next->cnt += cnt;
+      tree_insert (&runs_by_size, &next->size_elem);
+    }
+  else
+    {
+      struct free_run *run = malloc (sizeof *run);
+      if (run == NULL)
+        PANIC ("out of memory for the free map");
+      run->start = start;
+      run->cnt = cnt;
+      tree_insert (&runs_by_addr, &run->addr_elem);
+      tree_insert (&runs_by_size, &run->size_elem);
+    }
+}
+
+/* Marks the CNT sectors at START, which lie in RUN, as in use,
+   leaving what is left of RUN on either side of them free. */
+static void
+take_run (struct free_run *run, block_sector_t start, size_t cnt)
+{
+  block_sector_t end = run->start + run->cnt;
+
+  ASSERT (start >= run->start && start + cnt <= end);
+
+  tree_remove (&runs_by_size, &run->size_elem);
+  if (start > run->start)
+    {
+      run->cnt = start - run->start;
+      tree_insert (&runs_by_size, &run->size_elem);
+      if (start + cnt < end)
+        add_run (start + cnt, end - (start + cnt));
+    }
+  else if (start + cnt < end)
+    {
+      /* The run starts later, which keeps its place by address. */
+      run->start = start + cnt;
+      run->cnt = end - run->start;
+      tree_insert (&runs_by_size, &run->size_elem);
+    }
+  else
+    {
+      tree_remove (&runs_by_addr, &run->addr_elem);
+      free (run);
+    }
+
+  ASSERT (bitmap_none (free_map, start, cnt));
+  bitmap_set_multiple (free_map, start, cnt, true);
+  mark_dirty (start, cnt);
+  alloc_cnt += cnt;
+}
+
+/* Marks the free map file sectors holding the bits of the CNT
+   sectors at START as needing to be written. */
+static void
+mark_dirty (block_sector_t start, size_t cnt)
+{
+  if (cnt > 0)
+    bitmap_set_multiple (dirty_map, start / BITS_PER_SECTOR,
+                         (start + cnt - 1) / BITS_PER_SECTOR
+                         - start / BITS_PER_SECTOR + 1, true);
 }
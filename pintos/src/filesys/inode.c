@@ -2,10 +2,12 @@
 #include <list.h>
 #include <debug.h>
 #include <round.h>
+#include <stddef.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #ifdef P4FILESYS
+#include "filesys/cache.h"
 #include "threads/malloc.h"
 #endif
 
@@ -13,10 +15,13 @@
 #define INODE_MAGIC 0x87654321
 
 #ifdef P4FILESYS
-struct iblock_struct
-{
-	uint32_t block[128];
-};
+//sequential reads of a file start reading READAHEAD_MIN sectors ahead, and
+//double that with each further read in sequence, up to READAHEAD_MAX
+#define READAHEAD_MIN 2
+#define READAHEAD_MAX 32
+
+static void extent_get(struct inode *inode, size_t n, struct extent *e);
+static void inode_release(struct inode *inode);
 #endif
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -30,7 +35,9 @@ static inline size_t bytes_to_sectors(off_t size)
  within INODE.
  Returns -1 if INODE does not contain data for a byte at offset
  POS. */
-uint32_t byte_to_sector(const struct inode *inode, off_t pos)
+//The extent resolved last is kept in INODE, so a sequential scan looks
+//each extent up once.
+uint32_t byte_to_sector(struct inode *inode, off_t pos)
 {
 	if (!inode)
 		PANIC("Error: byte->sector function: inode passed is null!");
@@ -46,30 +53,24 @@ uint32_t byte_to_sector(const struct inode *inode, off_t pos)
 		{
 #ifdef P4FILESYS
 			ASSERT(inode!=NULL);
-			ASSERT(pos<MAX_FILESIZE);
-			uint32_t indirect[128];
-			off_t i0_limit = BLOCK_SECTOR_SIZE * I0_BLOCKS;
-			off_t i1_limit = BLOCK_SECTOR_SIZE * (I0_BLOCKS + 128);
-			if (pos >= i1_limit)
-			{
-				block_read(fs_device, inode->block[114], &indirect);
-				pos = pos - BLOCK_SECTOR_SIZE * (I0_BLOCKS + 128);
-				block_read(fs_device, indirect[pos / (BLOCK_SECTOR_SIZE * 128)],
-						&indirect);
-				return indirect[(pos % (BLOCK_SECTOR_SIZE * 128))
-						/ BLOCK_SECTOR_SIZE];
-			}
-			if (pos >= i0_limit && pos < i1_limit)
+			size_t idx = pos / BLOCK_SECTOR_SIZE;
+			size_t first = 0, n;
+			struct extent e;
+			if (idx >= inode->inode_data[ALLOC])
+				return -1;
+			if (inode->ext_first >= 0 && idx >= (size_t) inode->ext_first
+					&& idx < inode->ext_first + inode->ext_last.cnt)
+				return inode->ext_last.start + (idx - inode->ext_first);
+			for (n = 0;; n++)
 			{
-				pos = pos - BLOCK_SECTOR_SIZE * I0_BLOCKS;
-				block_read(fs_device,
-						inode->block[pos / (BLOCK_SECTOR_SIZE * 128)
-								+ I0_BLOCKS], &indirect);
-				return indirect[(pos % (BLOCK_SECTOR_SIZE * 128))
-						/ BLOCK_SECTOR_SIZE];
+				extent_get(inode, n, &e);
+				if (idx < first + e.cnt)
+					break;
+				first += e.cnt;
 			}
-			if (pos >= 0 && pos < i0_limit)
-				return inode->block[pos / BLOCK_SECTOR_SIZE];
+			inode->ext_first = first;
+			inode->ext_last = e;
+			return e.start + (idx - first);
 #endif
 			return inode->data.start + pos / BLOCK_SECTOR_SIZE;
 		}
@@ -131,8 +132,7 @@ bool inode_create(block_sector_t sector, off_t length, bool is_file)
 	}
 	return success;
 #else
-	struct inode inode =
-	{ };
+	struct inode *inode;
 	bool success = true;
 
 	ASSERT(length >= 0);
@@ -142,33 +142,37 @@ bool inode_create(block_sector_t sector, off_t length, bool is_file)
 	ASSERT(sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
 	disk_inode = calloc(1, sizeof *disk_inode);
-	if (disk_inode != NULL)
+	inode = calloc(1, sizeof *inode);
+	if (disk_inode != NULL && inode != NULL)
 	{
-		// the file size should be less than 2^23, i.e. 8MB
-		ASSERT(length <= (1 << 23));
-
-		size_t new_data_sectors = (length / BLOCK_SECTOR_SIZE + 1)
-				- DIV_ROUND_UP(inode.inode_data[LEN], BLOCK_SECTOR_SIZE);
-		inode_expand(&inode, length, new_data_sectors);
-		inode.inode_data[LEN] = length;
+		if (!inode_expand(inode, length, length))
+		{
+			inode_release(inode);
+			free(disk_inode);
+			free(inode);
+			return false;
+		}
+		inode->inode_data[LEN] = length;
 
 		//copy all data from inode to inode_disk
 		for (int i = 0; i < 10; i++)
-			disk_inode->inode_data[i] = inode.inode_data[i];
+			disk_inode->inode_data[i] = inode->inode_data[i];
 
 		disk_inode->length = length;
 		disk_inode->magic = INODE_MAGIC;
 		disk_inode->inode_data[DIR] = !is_file;
 		disk_inode->inode_data[PAR] = ROOT_DIR_SECTOR;
 
-		void *dest = memcpy(&disk_inode->block, &inode.block, MEM_SIZE);
+		void *dest = memcpy(&disk_inode->extents, &inode->extents,
+				sizeof inode->extents);
 		if (!dest)
 			success = false;
-		block_write(fs_device, sector, disk_inode);
-		free(disk_inode);
+		cache_write(sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
 	}
 	else
 		success = false;
+	free(disk_inode);
+	free(inode);
 	return success;
 #endif
 }
@@ -208,11 +212,12 @@ inode_open(block_sector_t sector)
 	inode->open_cnt = 1;
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
+	inode->write_cnt = 0;
 #ifndef P4FILESYS
 	block_read(fs_device, inode->sector, &inode->data);
 #endif
 #ifdef P4FILESYS
-	block_read(fs_device, inode->sector, &inode_d);
+	cache_read(inode->sector, &inode_d, 0, BLOCK_SECTOR_SIZE);
 	for (int i = 0; i < 10; i++)
 	{
 		if (i != LEN)
@@ -222,7 +227,11 @@ inode_open(block_sector_t sector)
 		else
 			inode->inode_data[LEN] = inode_d.length;
 	}
-	memcpy(&inode->block, &inode_d.block, MEM_SIZE);
+	memcpy(&inode->extents, &inode_d.extents, sizeof inode->extents);
+	inode->ra_next = 0;
+	inode->ra_window = 0;
+	inode->ra_end = 0;
+	inode->ext_first = -1;
 #endif
 	return inode;
 }
@@ -272,8 +281,8 @@ void inode_close(struct inode *inode)
 				else
 					inode_d.length = inode->inode_data[LEN];
 			}
-			memcpy(&inode_d.block, &inode->block, MEM_SIZE);
-			block_write(fs_device, inode->sector, &inode_d);
+			memcpy(&inode_d.extents, &inode->extents, sizeof inode->extents);
+			cache_write(inode->sector, &inode_d, 0, BLOCK_SECTOR_SIZE);
 			free(inode);
 			return;
 		}
@@ -286,6 +295,8 @@ void inode_close(struct inode *inode)
 #ifndef P4FILESYS
 			free_map_release(inode->data.start,
 					bytes_to_sectors(inode->data.length));
+#else
+			inode_release(inode);
 #endif
 
 		}
@@ -301,6 +312,44 @@ void inode_remove(struct inode *inode)
 	inode->removed = true;
 }
 
+#ifdef P4FILESYS
+//called after a read of SIZE bytes at OFFSET. If it carried on from the
+//last read, widens INODE's readahead window and queues the sectors after it
+//that are in the window and not queued yet. The sectors are looked up here,
+//and read by the cache's readahead thread.
+static void readahead(struct inode *inode, off_t offset, off_t size)
+{
+	off_t end = offset + size;
+	off_t pos, limit;
+
+	if (size == 0)
+		return;
+	if (offset != inode->ra_next)
+	{
+		inode->ra_window = 0;
+		inode->ra_end = 0;
+	}
+	else if (inode->ra_window == 0)
+		inode->ra_window = READAHEAD_MIN;
+	else if (inode->ra_window < READAHEAD_MAX)
+		inode->ra_window *= 2;
+	inode->ra_next = end;
+	if (inode->ra_window == 0)
+		return;
+
+	pos = ROUND_UP(end, BLOCK_SECTOR_SIZE);
+	limit = pos + inode->ra_window * BLOCK_SECTOR_SIZE;
+	if (limit > inode_length(inode))
+		limit = inode_length(inode);
+	if (pos < inode->ra_end)
+		pos = inode->ra_end;
+	for (; pos < limit; pos += BLOCK_SECTOR_SIZE)
+		cache_readahead(byte_to_sector(inode, pos));
+	if (pos > inode->ra_end)
+		inode->ra_end = pos;
+}
+#endif
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
  Returns the number of bytes actually read, which may be less
  than SIZE if an error occurs or end of file is reached. */
@@ -348,39 +397,7 @@ off_t inode_read_at(struct inode *inode, void *buffer_, off_t size,
 			memcpy(buffer + bytes_read, bounce + sector_ofs, chunk_size);
 		}
 #else
-		lock_acquire(&buffer_lock);
-		struct buffer_struct *bc = NULL;
-		int counter = 0;
-		for (struct list_elem *e = list_begin(&list_buffer);
-				e != list_end(&list_buffer); e = list_next(e))
-		{
-			struct buffer_struct *bc_temp = list_entry(e, struct buffer_struct,
-					buffer_listelem);
-			if (sector_idx == bc_temp->sector)
-			{
-				bc = bc_temp;
-				break;
-			}
-		}
-
-		while (bc == NULL)
-		{
-			bc = buffer_evict(sector_idx);
-			//try 100 times to get the block
-			if (counter++ == 100)
-				PANIC("Unable to allocate more buffer");
-		}
-
-		lock_release(&buffer_lock);
-
-		if (bc == NULL)
-			PANIC("In inode_read_at: Buffer cache entry in null");
-		else
-			bc->access = true;
-		void *dest = memcpy((void *) buffer + bytes_read,
-				(void *) &bc->content + sector_ofs, (size_t) chunk_size);
-		if (!dest)
-			PANIC("In inode_read_at: memcpy failed");
+		cache_read(sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
 #endif
 
 		/* Advance. */
@@ -390,6 +407,8 @@ off_t inode_read_at(struct inode *inode, void *buffer_, off_t size,
 	}
 #ifndef P4FILESYS
 	free(bounce);
+#else
+	readahead(inode, offset - bytes_read, bytes_read);
 #endif
 	return bytes_read;
 }
@@ -410,13 +429,13 @@ off_t inode_write_at(struct inode *inode, const void *buffer_, off_t size,
 
 	if (inode->deny_write_cnt)
 		return 0;
+	inode->write_cnt++;
 
 #ifdef P4FILESYS
 	if (offset + size > inode_length(inode))
 	{
-		size_t new_data_sectors = ((offset + size) / BLOCK_SECTOR_SIZE + 1)
-				- DIV_ROUND_UP(inode->inode_data[LEN], BLOCK_SECTOR_SIZE);
-		inode_expand(inode, offset + size, new_data_sectors);
+		if (!inode_expand(inode, offset + size, offset))
+			return 0;
 		inode->inode_data[LEN] = offset + size;
 	}
 #endif
@@ -464,41 +483,8 @@ off_t inode_write_at(struct inode *inode, const void *buffer_, off_t size,
 			block_write(fs_device, sector_idx, bounce);
 		}
 #else
-		lock_acquire(&buffer_lock);
-		int counter = 0;
-		struct buffer_struct *bc = NULL;
-		for (struct list_elem *e = list_begin(&list_buffer);
-				e != list_end(&list_buffer); e = list_next(e))
-		{
-			struct buffer_struct *bc_temp = list_entry(e, struct buffer_struct,
-					buffer_listelem);
-			if (sector_idx == bc_temp->sector)
-			{
-				bc = bc_temp;
-				break;
-			}
-		}
-
-		while (bc == NULL)
-		{
-			bc = buffer_evict(sector_idx);
-			//try 100 times to get the block
-			if (counter++ == 100)
-				PANIC("Unable to allocate more buffer");
-		}
-
-		lock_release(&buffer_lock);
-		if (bc == NULL)
-			PANIC("In inode_write_at: Buffer cache entry in null");
-		else
-		{
-			bc->dirty = true;
-			bc->access = true;
-		}
-		void *dest = memcpy((void *) &bc->content + sector_ofs,
-				(void *) buffer + bytes_written, (size_t) chunk_size);
-		if (!dest)
-			PANIC("In inode_write_at: memcpy failed");
+		cache_write(sector_idx, buffer + bytes_written, sector_ofs,
+				chunk_size);
 #endif
 
 		/* Advance. */
@@ -541,87 +527,200 @@ off_t inode_length(struct inode *inode)
 }
 
 #ifdef P4FILESYS
-//function to allocate more blocks
-void inode_expand(struct inode *inode, off_t length, size_t new_data_sectors)
+//returns the sector of INODE's Kth extent block
+static block_sector_t extent_block(struct inode *inode, size_t k)
 {
-#ifndef P4FILESYS
-	panic("Wrong invocation of the function");
-#endif
-	struct iblock_struct l1_block;
-	struct iblock_struct l2_block;
-	struct iblock_struct l3_block;
+	block_sector_t sector = inode->inode_data[EXT_NEXT];
+
+	while (k-- > 0)
+		cache_read(sector, &sector, offsetof(struct extent_block, next),
+				sizeof sector);
+	return sector;
+}
+
+//reads INODE's Nth extent into E
+static void extent_get(struct inode *inode, size_t n, struct extent *e)
+{
+	if (n < INODE_EXTENTS)
+		*e = inode->extents[n];
+	else
+	{
+		n -= INODE_EXTENTS;
+		cache_read(extent_block(inode, n / BLOCK_EXTENTS), e,
+				n % BLOCK_EXTENTS * sizeof *e, sizeof *e);
+	}
+}
+
+//writes E as INODE's Nth extent
+static void extent_set(struct inode *inode, size_t n, const struct extent *e)
+{
+	if (n < INODE_EXTENTS)
+		inode->extents[n] = *e;
+	else
+	{
+		n -= INODE_EXTENTS;
+		cache_write(extent_block(inode, n / BLOCK_EXTENTS), e,
+				n % BLOCK_EXTENTS * sizeof *e, sizeof *e);
+	}
+}
 
-	if (new_data_sectors)
+//adds the CNT sectors at START to the end of INODE's data, merged into the
+//last extent if they follow it. Returns false if a new extent block was
+//needed and the disk is full.
+static bool extent_append(struct inode *inode, block_sector_t start,
+		size_t cnt)
+{
+	size_t n = inode->inode_data[EXTS];
+	struct extent e;
+
+	if (n > 0)
 	{
-		for (; new_data_sectors && inode->inode_data[I0] < I0_BLOCKS;
-				inode->inode_data[I0] += 1)
+		extent_get(inode, n - 1, &e);
+		if (e.start + e.cnt == start)
 		{
-			new_data_sectors -= 1;
-			free_map_allocate(1, &inode->block[inode->inode_data[I0]]);
-			block_write(fs_device, inode->block[inode->inode_data[I0]], zeros);
+			e.cnt += cnt;
+			extent_set(inode, n - 1, &e);
+			inode->inode_data[ALLOC] += cnt;
+			return true;
 		}
-		while (new_data_sectors && inode->inode_data[I0] < I0_BLOCKS + 1)
-		{
-			if (inode->inode_data[I1])
-				block_read(fs_device, inode->block[inode->inode_data[I0]],
-						&l1_block);
-			else
-				free_map_allocate(1, &inode->block[inode->inode_data[I0]]);
+	}
+	if (n >= INODE_EXTENTS && (n - INODE_EXTENTS) % BLOCK_EXTENTS == 0)
+	{
+		block_sector_t sector;
 
-			for (; new_data_sectors && inode->inode_data[I1] < 128;
-					inode->inode_data[I1]++)
-			{
-				new_data_sectors -= 1;
-				free_map_allocate(1, &l1_block.block[inode->inode_data[I1]]);
-				block_write(fs_device, l1_block.block[inode->inode_data[I1]],
-						zeros);
-			}
-			block_write(fs_device, inode->block[inode->inode_data[I0]],
-					&l1_block);
-			if (inode->inode_data[I1] >= 128)
-			{
-				inode->inode_data[I0] += 1;
-				inode->inode_data[I1] = 0;
-			}
+		if (!free_map_allocate(1, &sector))
+			return false;
+		cache_write(sector, zeros, 0, BLOCK_SECTOR_SIZE);
+		if (n == INODE_EXTENTS)
+			inode->inode_data[EXT_NEXT] = sector;
+		else
+			cache_write(
+					extent_block(inode, (n - INODE_EXTENTS) / BLOCK_EXTENTS - 1),
+					&sector, offsetof(struct extent_block, next),
+					sizeof sector);
+	}
+	e.start = start;
+	e.cnt = cnt;
+	extent_set(inode, n, &e);
+	inode->inode_data[EXTS]++;
+	inode->inode_data[ALLOC] += cnt;
+	return true;
+}
+
+//shrinks INODE's data to its first ALLOC sectors, giving the rest and any
+//extent blocks left empty back to the free map
+static void extent_trim(struct inode *inode, size_t alloc)
+{
+	while (inode->inode_data[ALLOC] > alloc)
+	{
+		size_t n = inode->inode_data[EXTS] - 1;
+		size_t excess = inode->inode_data[ALLOC] - alloc;
+		struct extent e;
+
+		extent_get(inode, n, &e);
+		if (e.cnt > excess)
+		{
+			e.cnt -= excess;
+			free_map_release(e.start + e.cnt, excess);
+			extent_set(inode, n, &e);
+			inode->inode_data[ALLOC] = alloc;
+			break;
 		}
-		while (new_data_sectors && inode->inode_data[I0] <= I0_BLOCKS + 1)
+		free_map_release(e.start, e.cnt);
+		inode->inode_data[ALLOC] -= e.cnt;
+		inode->inode_data[EXTS] = n;
+		if (n >= INODE_EXTENTS && (n - INODE_EXTENTS) % BLOCK_EXTENTS == 0)
 		{
+			size_t k = (n - INODE_EXTENTS) / BLOCK_EXTENTS;
+			block_sector_t none = 0;
 
-			if (inode->inode_data[I2] || inode->inode_data[I1])
-				block_read(fs_device, inode->block[inode->inode_data[I0]],
-						&l2_block);
+			free_map_release(extent_block(inode, k), 1);
+			if (k == 0)
+				inode->inode_data[EXT_NEXT] = 0;
 			else
-				free_map_allocate(1, &inode->block[inode->inode_data[I0]]);
+				cache_write(extent_block(inode, k - 1), &none,
+						offsetof(struct extent_block, next), sizeof none);
+		}
+	}
+}
 
-			while (new_data_sectors && inode->inode_data[I1] < 128)
-			{
-				if (inode->inode_data[I2])
-					block_read(fs_device, l2_block.block[inode->inode_data[I1]],
-							&l3_block);
-				else
-					free_map_allocate(1, &l2_block.block[inode->inode_data[I1]]);
-
-				for (; new_data_sectors && inode->inode_data[I2] < 128;
-						inode->inode_data[I2]++)
-				{
-					new_data_sectors -= 1;
-					free_map_allocate(1, &l3_block.block[inode->inode_data[I2]]);
-					block_write(fs_device, l3_block.block[inode->inode_data[I2]],
-							zeros);
-				}
-				block_write(fs_device, l2_block.block[inode->inode_data[I1]],
-						&l3_block);
-				if (inode->inode_data[I2] >= 128)
-				{
-					inode->inode_data[I1] += 1;
-					inode->inode_data[I2] = 0;
-				}
-			}
-			block_write(fs_device, inode->block[inode->inode_data[I0]],
-					&l2_block);
+//grows INODE's data to LENGTH bytes. New sectors are zeroed, but for those
+//wholly past WRITTEN, which the caller is about to write. The growth is
+//asked of the free map as one run, first right after the last extent, then
+//anywhere, then in halves until runs are found. Returns false if the disk
+//is full, after giving back what it took.
+bool inode_expand(struct inode *inode, off_t length, off_t written)
+{
+	size_t need = bytes_to_sectors(length);
+	size_t keep_from = DIV_ROUND_UP(written, BLOCK_SECTOR_SIZE);
+	size_t keep_to = length / BLOCK_SECTOR_SIZE;
+	size_t old_alloc = inode->inode_data[ALLOC];
+
+	//the last extent may grow
+	inode->ext_first = -1;
+
+	while (inode->inode_data[ALLOC] < need)
+	{
+		size_t first = inode->inode_data[ALLOC];
+		size_t cnt = need - first;
+		block_sector_t start = 0;
+		bool found = false;
+		struct extent e;
+		size_t i;
+
+		if (inode->inode_data[EXTS] > 0)
+		{
+			extent_get(inode, inode->inode_data[EXTS] - 1, &e);
+			start = e.start + e.cnt;
+			found = free_map_allocate_at(start, cnt);
 		}
+		while (!found && !(found = free_map_allocate(cnt, &start)))
+		{
+			if (cnt == 1)
+				goto fail;
+			cnt /= 2;
+		}
+		if (!extent_append(inode, start, cnt))
+		{
+			free_map_release(start, cnt);
+			goto fail;
+		}
+		for (i = 0; i < cnt; i++)
+			if (first + i < keep_from || first + i >= keep_to)
+				cache_write(start + i, zeros, 0, BLOCK_SECTOR_SIZE);
+	}
+	free_map_sync();
+	return true;
+
+fail:
+	//the sectors left unzeroed for the caller would show stale data
+	extent_trim(inode, old_alloc);
+	free_map_sync();
+	return false;
+}
+
+//gives INODE's data sectors and extent blocks back to the free map
+static void inode_release(struct inode *inode)
+{
+	block_sector_t sector = inode->inode_data[EXT_NEXT];
+	struct extent e;
+	size_t n;
+
+	for (n = 0; n < inode->inode_data[EXTS]; n++)
+	{
+		extent_get(inode, n, &e);
+		free_map_release(e.start, e.cnt);
+	}
+	while (sector != 0)
+	{
+		block_sector_t next;
+
+		cache_read(sector, &next, offsetof(struct extent_block, next),
+				sizeof next);
+		free_map_release(sector, 1);
+		sector = next;
 	}
-	return;
+	free_map_sync();
 }
 
 uint32_t inode_op(int operation, struct inode * inode)
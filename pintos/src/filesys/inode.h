@@ -12,20 +12,34 @@
 #define OP_OPENCNT 2
 
 //defines data to be stored in inode_disk
-#define I0 0
-#define I1 1
-#define I2 2
-#define I3 3
+#define EXTS 0 //extents of the file
+#define EXT_NEXT 1 //first extent block, 0 if none
+#define ALLOC 2 //data sectors in the extents
 #define PAR 4
 #define DIR 5
 #define LEN 6
 #define SIZE 7
 
-#define MEM_SIZE (115 * sizeof(uint32_t))
 char zeros[BLOCK_SECTOR_SIZE];
 
-#define I0_BLOCKS 113
-#define MAX_FILESIZE 8512000
+//The data of a file is a list of extents, runs of sectors. The first
+//INODE_EXTENTS are in the inode, the rest in a chain of extent blocks.
+#define INODE_EXTENTS 57
+#define BLOCK_EXTENTS 63
+
+struct extent
+{
+	block_sector_t start; //first sector of the run
+	uint32_t cnt; //sectors in the run
+};
+
+//an extent block, one sector long
+struct extent_block
+{
+	struct extent extents[BLOCK_EXTENTS];
+	block_sector_t next; //next extent block, 0 if none
+	uint32_t unused;
+};
 
 /* On-disk inode.
  Must be exactly BLOCK_SECTOR_SIZE bytes long. */
@@ -39,7 +53,8 @@ struct inode_disk
 	uint32_t unused[125]; /* Not used. */
 #else
 	uint32_t inode_data[10];
-	block_sector_t block[115];
+	struct extent extents[INODE_EXTENTS];
+	uint32_t unused;
 #endif
 };
 
@@ -52,10 +67,18 @@ struct inode
 	bool removed; /* True if deleted, false otherwise. */
 	int deny_write_cnt; /* 0: writes ok, >0: deny writes. */
 	struct inode_disk data; /* Inode content. */
+	unsigned write_cnt; //writes so far, for copies of the data to tell if stale
 
 #ifdef P4FILESYS
 	uint32_t inode_data[10];
-	uint32_t block[115];
+	struct extent extents[INODE_EXTENTS];
+
+	off_t ra_next; //offset a sequential read would start at
+	int ra_window; //sectors read ahead of a sequential read, 0 if random
+	off_t ra_end; //end of what has been queued for readahead
+
+	off_t ext_first; //first file sector in EXT_LAST, -1 if none
+	struct extent ext_last; //extent byte_to_sector() resolved last
 #endif
 };
 
@@ -70,6 +93,7 @@ bool inode_create(block_sector_t, off_t, bool);
 struct inode *inode_open(block_sector_t);
 struct inode *inode_reopen(struct inode *);
 block_sector_t inode_get_inumber(const struct inode *);
+uint32_t byte_to_sector(struct inode *inode, off_t pos);
 void inode_close(struct inode *);
 void inode_remove(struct inode *);
 off_t inode_read_at(struct inode *, void *, off_t size, off_t offset);
@@ -78,6 +102,6 @@ void inode_deny_write(struct inode *);
 void inode_allow_write(struct inode *);
 off_t inode_length(struct inode *);
 
-void inode_expand(struct inode *inode, off_t length, size_t new_data_sectors);
+bool inode_expand(struct inode *inode, off_t length, off_t written);
 
 #endif /* filesys/inode.h */
@@ -358,6 +358,19 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the SIZE bytes at byte offset OFS of B's file image to
+   the same offset in FILE.  Returns true if successful, false
+   otherwise. */
+bool
+bitmap_write_part (const struct bitmap *b, struct file *file,
+                   size_t ofs, size_t size)
+{
+  ASSERT (ofs <= byte_cnt (b->bit_cnt));
+  ASSERT (size <= byte_cnt (b->bit_cnt) - ofs);
+  return (size_t) file_write_at (file, (uint8_t *) b->bits + ofs,
+                                 size, ofs) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
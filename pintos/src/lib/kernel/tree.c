@@ -0,0 +1,322 @@
+#include "tree.h"
+#include "../debug.h"
+
+static int height (const struct tree_elem *);
+static void update_height (struct tree_elem *);
+static void replace_child (struct tree *, struct tree_elem *old,
+                           struct tree_elem *new);
+static struct tree_elem *rotate_left (struct tree *, struct tree_elem *);
+static struct tree_elem *rotate_right (struct tree *, struct tree_elem *);
+static void rebalance (struct tree *, struct tree_elem *);
+
+/* Initializes tree T to be empty, with elements ordered by LESS
+   given auxiliary data AUX. */
+void
+tree_init (struct tree *t, tree_less_func *less, void *aux) 
+{
+  ASSERT (t != NULL);
+  ASSERT (less != NULL);
+
+  t->root = NULL;
+  t->elem_cnt = 0;
+  t->less = less;
+  t->aux = aux;
+}
+
+/* Inserts NEW into tree T and returns a null pointer, if no
+   equal element is already in the tree.
+   If an equal element is already in the tree, returns it
+   without inserting NEW. */
+struct tree_elem *
+tree_insert (struct tree *t, struct tree_elem *new) 
+{
+  struct tree_elem *parent = NULL;
+  struct tree_elem **link = &t->root;
+
+  while (*link != NULL) 
+    {
+      parent = *link;
+      if (t->less (new, parent, t->aux))
+        link = &parent->left;
+      else if (t->less (parent, new, t->aux))
+        link = &parent->right;
+      else
+        return parent;
+    }
+
+  new->parent = parent;
+  new->left = new->right = NULL;
+  new->height = 1;
+  *link = new;
+  t->elem_cnt++;
+  rebalance (t, parent);
+  return NULL;
+}
+
+/* Removes element E, which must be in tree T. */
+void
+tree_remove (struct tree *t, struct tree_elem *e) 
+{
+  struct tree_elem *fix;
+
+  if (e->left != NULL && e->right != NULL) 
+    {
+      /* E's successor has no left child.  Unlink it and put it
+         in E's place. */
+      struct tree_elem *s = e->right;
+      while (s->left != NULL)
+        s = s->left;
+
+      if (s->parent != e) 
+        {
+          fix = s->parent;
+          replace_child (t, s, s->right);
+          s->right = e->right;
+          s->right->parent = s;
+        }
+      else
+        fix = s;
+      replace_child (t, e, s);
+      s->left = e->left;
+      s->left->parent = s;
+    }
+  else 
+    {
+      fix = e->parent;
+      replace_child (t, e, e->left != NULL ? e->left : e->right);
+    }
+
+  t->elem_cnt--;
+  rebalance (t, fix);
+}
+
+/* Finds and returns an element equal to KEY in tree T, or a null
+   pointer if no equal element exists in the tree. */
+struct tree_elem *
+tree_find (struct tree *t, const struct tree_elem *key) 
+{
+  struct tree_elem *e = t->root;
+
+  while (e != NULL)
+    if (t->less (key, e, t->aux))
+      e = e->left;
+    else if (t->less (e, key, t->aux))
+      e = e->right;
+    else
+      return e;
+  return NULL;
+}
+
+/* Returns the greatest element in tree T that is not greater
+   than KEY, or a null pointer if there is none. */
+struct tree_elem *
+tree_floor (struct tree *t, const struct tree_elem *key) 
+{
+  struct tree_elem *e = t->root;
+  struct tree_elem *best = NULL;
+
+  while (e != NULL)
+    if (t->less (key, e, t->aux))
+      e = e->left;
+    else 
+      {
+        best = e;
+        if (!t->less (e, key, t->aux))
+          break;
+        e = e->right;
+      }
+  return best;
+}
+
+/* Returns the least element in tree T that is not less than KEY,
+   or a null pointer if there is none. */
+struct tree_elem *
+tree_ceiling (struct tree *t, const struct tree_elem *key) 
+{
+  struct tree_elem *e = t->root;
+  struct tree_elem *best = NULL;
+
+  while (e != NULL)
+    if (t->less (e, key, t->aux))
+      e = e->right;
+    else 
+      {
+        best = e;
+        if (!t->less (key, e, t->aux))
+          break;
+        e = e->left;
+      }
+  return best;
+}
+
+/* Returns the least element in tree T, or a null pointer if T is
+   empty. */
+struct tree_elem *
+tree_first (struct tree *t) 
+{
+  struct tree_elem *e = t->root;
+
+  if (e != NULL)
+    while (e->left != NULL)
+      e = e->left;
+  return e;
+}
+
+/* Returns the greatest element in tree T, or a null pointer if T
+   is empty. */
+struct tree_elem *
+tree_last (struct tree *t) 
+{
+  struct tree_elem *e = t->root;
+
+  if (e != NULL)
+    while (e->right != NULL)
+      e = e->right;
+  return e;
+}
+
+/* Returns the element that follows E in its tree, or a null
+   pointer if E is the greatest element. */
+struct tree_elem *
+tree_next (struct tree_elem *e) 
+{
+  if (e->right != NULL) 
+    {
+      e = e->right;
+      while (e->left != NULL)
+        e = e->left;
+      return e;
+    }
+  while (e->parent != NULL && e == e->parent->right)
+    e = e->parent;
+  return e->parent;
+}
+
+/* Returns the element that precedes E in its tree, or a null
+   pointer if E is the least element. */
+struct tree_elem *
+tree_prev (struct tree_elem *e) 
+{
+  if (e->left != NULL) 
+    {
+      e = e->left;
+      while (e->right != NULL)
+        e = e->right;
+      return e;
+    }
+  while (e->parent != NULL && e == e->parent->left)
+    e = e->parent;
+  return e->parent;
+}
+
+/* Returns the number of elements in T. */
+size_t
+tree_size (struct tree *t) 
+{
+  return t->elem_cnt;
+}
+
+/* Returns true if T contains no elements, false otherwise. */
+bool
+tree_empty (struct tree *t) 
+{
+  return t->elem_cnt == 0;
+}
+
+/* Returns the height of the subtree rooted at E, 0 if E is a null
+   pointer. */
+static int
+height (const struct tree_elem *e) 
+{
+  return e != NULL ? e->height : 0;
+}
+
+/* Recomputes E's height from those of its children. */
+static void
+update_height (struct tree_elem *e) 
+{
+  int left = height (e->left);
+  int right = height (e->right);
+
+  e->height = (left > right ? left : right) + 1;
+}
+
+/* Puts NEW, which may be a null pointer, in OLD's place as the
+   child of OLD's parent, or as the root of T. */
+static void
+replace_child (struct tree *t, struct tree_elem *old, struct tree_elem *new) 
+{
+  struct tree_elem *parent = old->parent;
+
+  if (parent == NULL)
+    t->root = new;
+  else if (parent->left == old)
+    parent->left = new;
+  else
+    parent->right = new;
+  if (new != NULL)
+    new->parent = parent;
+}
+
+/* Rotates the subtree rooted at E to the left and returns its new
+   root, E's former right child. */
+static struct tree_elem *
+rotate_left (struct tree *t, struct tree_elem *e) 
+{
+  struct tree_elem *r = e->right;
+
+  replace_child (t, e, r);
+  e->right = r->left;
+  if (r->left != NULL)
+    r->left->parent = e;
+  r->left = e;
+  e->parent = r;
+  update_height (e);
+  update_height (r);
+  return r;
+}
+
+/* Rotates the subtree rooted at E to the right and returns its
+   new root, E's former left child. */
+static struct tree_elem *
+rotate_right (struct tree *t, struct tree_elem *e) 
+{
+  struct tree_elem *l = e->left;
+
+  replace_child (t, e, l);
+  e->left = l->right;
+  if (l->right != NULL)
+    l->right->parent = e;
+  l->right = e;
+  e->parent = l;
+  update_height (e);
+  update_height (l);
+  return l;
+}
+
+/* Restores heights and balance on the path from E, which may be
+   a null pointer, up to the root of T. */
+static void
+rebalance (struct tree *t, struct tree_elem *e) 
+{
+  while (e != NULL) 
+    {
+      int balance = height (e->left) - height (e->right);
+
+      if (balance > 1) 
+        {
+          if (height (e->left->left) < height (e->left->right))
+            rotate_left (t, e->left);
+          e = rotate_right (t, e);
+        }
+      else if (balance < -1) 
+        {
+          if (height (e->right->right) < height (e->right->left))
+            rotate_right (t, e->right);
+          e = rotate_left (t, e);
+        }
+      else
+        update_height (e);
+      e = e->parent;
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef __LIB_KERNEL_TREE_H
+#define __LIB_KERNEL_TREE_H
+
+/* Balanced binary search tree.
+
+   This is an AVL tree: at every node the heights of the two
+   subtrees differ by at most one, so that lookup, insertion and
+   removal all take O(log n) time, and the elements can be walked
+   in order.
+
+   As with lists and hash tables, the tree does no dynamic
+   allocation.  Each structure that can be in a tree embeds a
+   struct tree_elem member, and tree_entry() converts a pointer
+   to that member back into a pointer to the structure.
+
+   Elements are ordered by a tree_less_func.  No two elements in
+   a tree may compare equal: tree_insert() refuses an element
+   equal to one already present.  To look something up, fill in
+   the key fields of a dummy structure and pass a pointer to its
+   struct tree_elem. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Tree element. */
+struct tree_elem 
+  {
+    struct tree_elem *parent;   /* Parent, or null for the root. */
+    struct tree_elem *left;     /* Smaller elements. */
+    struct tree_elem *right;    /* Greater elements. */
+    int height;                 /* Height of this subtree, 1 for a leaf. */
+  };
+
+/* Converts pointer to tree element TREE_ELEM into a pointer to
+   the structure that TREE_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the tree element. */
+#define tree_entry(TREE_ELEM, STRUCT, MEMBER)                   \
+        ((STRUCT *) ((uint8_t *) &(TREE_ELEM)->parent           \
+                     - offsetof (STRUCT, MEMBER.parent)))
+
+/* Compares the value of two tree elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool tree_less_func (const struct tree_elem *a,
+                             const struct tree_elem *b,
+                             void *aux);
+
+/* Tree. */
+struct tree 
+  {
+    struct tree_elem *root;     /* Root element, or null if empty. */
+    size_t elem_cnt;            /* Number of elements in tree. */
+    tree_less_func *less;       /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `less'. */
+  };
+
+void tree_init (struct tree *, tree_less_func *, void *aux);
+
+/* Insertion and removal. */
+struct tree_elem *tree_insert (struct tree *, struct tree_elem *);
+void tree_remove (struct tree *, struct tree_elem *);
+
+/* Search. */
+struct tree_elem *tree_find (struct tree *, const struct tree_elem *);
+struct tree_elem *tree_floor (struct tree *, const struct tree_elem *);
+struct tree_elem *tree_ceiling (struct tree *, const struct tree_elem *);
+
+/* Traversal in order. */
+struct tree_elem *tree_first (struct tree *);
+struct tree_elem *tree_last (struct tree *);
+struct tree_elem *tree_next (struct tree_elem *);
+struct tree_elem *tree_prev (struct tree_elem *);
+
+/* Information. */
+size_t tree_size (struct tree *);
+bool tree_empty (struct tree *);
+
+#endif /* lib/kernel/tree.h */
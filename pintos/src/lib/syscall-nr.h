@@ -28,7 +28,14 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_FORK,                   /* Duplicate the calling process. */
+    SYS_MSYNC,                  /* Write a memory mapping back to its file. */
+    SYS_MADVISE,                /* Give a hint about memory accesses. */
+    SYS_MMAP_ANON,              /* Map zero-filled memory. */
+    SYS_SBRK                    /* Move the end of the heap. */
   };
 
 #endif /* lib/syscall-nr.h */
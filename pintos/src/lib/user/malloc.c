@@ -0,0 +1,344 @@
+#include <malloc.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+
+/* A user-space implementation of malloc(), on top of sbrk().
+
+   Like the kernel's, it rounds the size of each request up to a
+   power of 2 and hands it to the "descriptor" of that size
+   class, which keeps a free list of its blocks.  If the list is
+   empty, a new page, called an "arena", is taken from the end of
+   the heap with sbrk() and divided into blocks of the class.
+   Arenas stay in the heap once made.
+
+   Requests too big for a block get a run of whole pages with the
+   arena header at its start.  Freed runs are kept on a list of
+   their own, in address order with neighbours merged, and are
+   reused first fit by later big requests.  A free run that ends
+   at the break is given back with a negative sbrk().
+
+   Processes have a single thread, so nothing is locked. */
+
+/* Size of an arena. */
+#define PAGE_SIZE 4096
+
+/* Descriptor. */
+struct desc
+  {
+    size_t block_size;          /* Size of each element in bytes. */
+    size_t blocks_per_arena;    /* Number of blocks in an arena. */
+    struct block *free_list;    /* Free blocks. */
+  };
+
+/* Magic number for detecting arena corruption. */
+#define ARENA_MAGIC 0x9a548eed
+
+/* Arena. */
+struct arena
+  {
+    unsigned magic;             /* Always set to ARENA_MAGIC. */
+    struct desc *desc;          /* Owning descriptor, null for big block. */
+    size_t page_cnt;            /* Pages in big block. */
+    struct arena *next_free;    /* Next free run of pages. */
+  };
+
+/* Free block. */
+struct block
+  {
+    struct block *next;         /* Next free block of the descriptor. */
+  };
+
+/* Our set of descriptors. */
+static struct desc descs[8];    /* Descriptors. */
+static size_t desc_cnt;         /* Number of descriptors. */
+
+/* Free runs of pages, in address order. */
+static struct arena *free_runs;
+
+static void *heap_pages (size_t page_cnt);
+static void *big_alloc (size_t size);
+static void big_free (struct arena *);
+static size_t block_size (void *);
+static struct arena *block_to_arena (struct block *);
+static struct block *arena_to_block (struct arena *, size_t idx);
+
+/* Initializes the descriptors, on the first call to malloc(). */
+static void
+malloc_init (void)
+{
+  size_t size;
+
+  for (size = 16; size < PAGE_SIZE / 2; size *= 2)
+    {
+      struct desc *d = &descs[desc_cnt++];
+      ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
+      d->block_size = size;
+      d->blocks_per_arena = (PAGE_SIZE - sizeof (struct arena)) / size;
+      d->free_list = NULL;
+    }
+}
+
+/* Obtains and returns a new block of at least SIZE bytes.
+   Returns a null pointer if the heap cannot grow. */
+void *
+malloc (size_t size)
+{
+  struct desc *d;
+  struct block *b;
+
+  /* A null pointer satisfies a request for 0 bytes. */
+  if (size == 0)
+    return NULL;
+  if (desc_cnt == 0)
+    malloc_init ();
+
+  /* Find the smallest descriptor that satisfies a SIZE-byte
+     request. */
+  for (d = descs; d < descs + desc_cnt; d++)
+    if (d->block_size >= size)
+      break;
+  if (d == descs + desc_cnt)
+    return big_alloc (size);
+
+  /* If the free list is empty, create a new arena. */
+  if (d->free_list == NULL)
+    {
+      struct arena *a = heap_pages (1);
+      size_t i;
+
+      if (a == NULL)
+        return NULL;
+      a->magic = ARENA_MAGIC;
+      a->desc = d;
+      a->page_cnt = 1;
+      a->next_free = NULL;
+      for (i = d->blocks_per_arena; i-- > 0; )
+        {
+          b = arena_to_block (a, i);
+          b->next = d->free_list;
+          d->free_list = b;
+        }
+    }
+
+  b = d->free_list;
+  d->free_list = b->next;
+  return b;
+}
+
+/* Allocates and returns A times B bytes initialized to zeroes.
+   Returns a null pointer if memory is not available. */
+void *
+calloc (size_t a, size_t b)
+{
+  void *p;
+  size_t size;
+
+  /* Calculate block size and make sure it fits in size_t. */
+  size = a * b;
+  if (size < a || size < b)
+    return NULL;
+
+  p = malloc (size);
+  if (p != NULL)
+    memset (p, 0, size);
+  return p;
+}
+
+/* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
+   moving it in the process.  Returns the new block, or a null
+   pointer if it could not be resized, in which case OLD_BLOCK is
+   left as it was.  A call with null OLD_BLOCK is equivalent to
+   malloc(NEW_SIZE).  A call with zero NEW_SIZE is equivalent to
+   free(OLD_BLOCK). */
+void *
+realloc (void *old_block, size_t new_size)
+{
+  if (new_size == 0)
+    {
+      free (old_block);
+      return NULL;
+    }
+  else
+    {
+      void *new_block = malloc (new_size);
+      if (old_block != NULL && new_block != NULL)
+        {
+          size_t old_size = block_size (old_block);
+          size_t min_size = new_size < old_size ? new_size : old_size;
+          memcpy (new_block, old_block, min_size);
+          free (old_block);
+        }
+      return new_block;
+    }
+}
+
+/* Frees block P, which must have been previously allocated with
+   malloc(), calloc(), or realloc(). */
+void
+free (void *p)
+{
+  struct block *b = p;
+  struct arena *a;
+
+  if (p == NULL)
+    return;
+
+  a = block_to_arena (b);
+  if (a->desc != NULL)
+    {
+      /* It's a normal block.  Add it to its descriptor's free
+         list. */
+      b->next = a->desc->free_list;
+      a->desc->free_list = b;
+    }
+  else
+    big_free (a);
+}
+
+/* Returns PAGE_CNT new pages from the end of the heap, or a null
+   pointer.  A break left unaligned by a caller of sbrk() is
+   first moved up to a page boundary. */
+static void *
+heap_pages (size_t page_cnt)
+{
+  uint8_t *brk = sbrk (0);
+  size_t pad;
+
+  if (brk == (void *) -1)
+    return NULL;
+  pad = ROUND_UP ((uintptr_t) brk, PAGE_SIZE) - (uintptr_t) brk;
+  if (sbrk (pad + page_cnt * PAGE_SIZE) == (void *) -1)
+    return NULL;
+  return brk + pad;
+}
+
+/* Returns the end of the run of pages A. */
+static uint8_t *
+run_end (struct arena *a)
+{
+  return (uint8_t *) a + a->page_cnt * PAGE_SIZE;
+}
+
+/* Allocates a block of SIZE bytes, too big for any descriptor,
+   from a free run of pages if one is big enough, else from the
+   end of the heap. */
+static void *
+big_alloc (size_t size)
+{
+  struct arena **ap, *a;
+  size_t page_cnt;
+
+  if (size > SIZE_MAX - sizeof *a - PAGE_SIZE)
+    return NULL;
+  page_cnt = DIV_ROUND_UP (size + sizeof *a, PAGE_SIZE);
+
+  for (ap = &free_runs; *ap != NULL; ap = &(*ap)->next_free)
+    if ((*ap)->page_cnt >= page_cnt)
+      {
+        a = *ap;
+        if (a->page_cnt > page_cnt)
+          {
+            /* Leave the tail of the run on the list. */
+            struct arena *rest = (struct arena *) (run_end (a)
+                                 - (a->page_cnt - page_cnt) * PAGE_SIZE);
+            rest->magic = ARENA_MAGIC;
+            rest->desc = NULL;
+            rest->page_cnt = a->page_cnt - page_cnt;
+            rest->next_free = a->next_free;
+            *ap = rest;
+            a->page_cnt = page_cnt;
+          }
+        else
+          *ap = a->next_free;
+        return a + 1;
+      }
+
+  a = heap_pages (page_cnt);
+  if (a == NULL)
+    return NULL;
+  a->magic = ARENA_MAGIC;
+  a->desc = NULL;
+  a->page_cnt = page_cnt;
+  return a + 1;
+}
+
+/* Puts the big block A back on the list of free runs, and gives
+   the last run back to the heap if it ends at the break. */
+static void
+big_free (struct arena *a)
+{
+  struct arena **ap, *prev = NULL;
+
+  for (ap = &free_runs; *ap != NULL && *ap < a; ap = &(*ap)->next_free)
+    prev = *ap;
+  a->next_free = *ap;
+  *ap = a;
+
+  /* Merge with the runs right after and before it. */
+  if (a->next_free != NULL && run_end (a) == (uint8_t *) a->next_free)
+    {
+      a->page_cnt += a->next_free->page_cnt;
+      a->next_free = a->next_free->next_free;
+    }
+  if (prev != NULL && run_end (prev) == (uint8_t *) a)
+    {
+      prev->page_cnt += a->page_cnt;
+      prev->next_free = a->next_free;
+    }
+
+  for (ap = &free_runs; (*ap)->next_free != NULL; ap = &(*ap)->next_free)
+    continue;
+  if (run_end (*ap) == (uint8_t *) sbrk (0))
+    {
+      intptr_t size = (*ap)->page_cnt * PAGE_SIZE;
+      *ap = NULL;
+      sbrk (-size);
+    }
+}
+
+/* Returns the number of bytes allocated for BLOCK. */
+static size_t
+block_size (void *block)
+{
+  struct block *b = block;
+  struct arena *a = block_to_arena (b);
+
+  return a->desc != NULL ? a->desc->block_size
+                         : a->page_cnt * PAGE_SIZE - sizeof *a;
+}
+
+/* Returns the arena that block B is inside. */
+static struct arena *
+block_to_arena (struct block *b)
+{
+  struct arena *a = (struct arena *) ((uintptr_t) b & ~(PAGE_SIZE - 1));
+
+  /* Check that the arena is valid. */
+  ASSERT (a != NULL);
+  ASSERT (a->magic == ARENA_MAGIC);
+
+  /* Check that the block is properly aligned for the arena. */
+  ASSERT (a->desc == NULL
+          || (uintptr_t) b % PAGE_SIZE >= sizeof *a);
+  ASSERT (a->desc == NULL
+          || ((uintptr_t) b % PAGE_SIZE - sizeof *a)
+             % a->desc->block_size == 0);
+  ASSERT (a->desc != NULL || (uintptr_t) b % PAGE_SIZE == sizeof *a);
+
+  return a;
+}
+
+/* Returns the (IDX - 1)'th block within arena A. */
+static struct block *
+arena_to_block (struct arena *a, size_t idx)
+{
+  ASSERT (a != NULL);
+  ASSERT (a->magic == ARENA_MAGIC);
+  ASSERT (idx < a->desc->blocks_per_arena);
+  return (struct block *) ((uint8_t *) a
+                           + sizeof *a
+                           + idx * a->desc->block_size);
+}
@@ -81,6 +81,12 @@ exec (const char *file)
   return (pid_t) syscall1 (SYS_EXEC, file);
 }
 
+pid_t
+fork (void)
+{
+  return (pid_t) syscall0 (SYS_FORK);
+}
+
 int
 wait (pid_t pid)
 {
@@ -153,6 +159,30 @@ munmap (mapid_t mapid)
   syscall1 (SYS_MUNMAP, mapid);
 }
 
+void
+msync (mapid_t mapid)
+{
+  syscall1 (SYS_MSYNC, mapid);
+}
+
+bool
+madvise (void *addr, unsigned size, int advice)
+{
+  return syscall3 (SYS_MADVISE, addr, size, advice);
+}
+
+mapid_t
+mmap_anon (void *addr, unsigned length)
+{
+  return syscall2 (SYS_MMAP_ANON, addr, length);
+}
+
+void *
+sbrk (intptr_t increment)
+{
+  return (void *) syscall1 (SYS_SBRK, increment);
+}
+
 bool
 chdir (const char *dir)
 {
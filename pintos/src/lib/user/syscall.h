@@ -2,6 +2,7 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <debug.h>
 
 /* Process identifier. */
@@ -12,6 +13,13 @@ typedef int pid_t;
 typedef int mapid_t;
 #define MAP_FAILED ((mapid_t) -1)
 
+/* Access hints for madvise(). */
+#define MADV_NORMAL 0           /* No particular pattern. */
+#define MADV_SEQUENTIAL 1       /* Read ahead, drop what was passed. */
+#define MADV_RANDOM 2           /* Do not read ahead. */
+#define MADV_WILLNEED 3         /* Read in the background now. */
+#define MADV_DONTNEED 4         /* Discard, refetch on next access. */
+
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
@@ -23,6 +31,7 @@ typedef int mapid_t;
 void halt (void) NO_RETURN;
 void exit (int status) NO_RETURN;
 pid_t exec (const char *file);
+pid_t fork (void);
 int wait (pid_t);
 bool create (const char *file, unsigned initial_size);
 bool remove (const char *file);
@@ -37,6 +46,10 @@ void close (int fd);
 /* Project 3 and optionally project 4. */
 mapid_t mmap (int fd, void *addr);
 void munmap (mapid_t);
+void msync (mapid_t);
+bool madvise (void *addr, unsigned size, int advice);
+mapid_t mmap_anon (void *addr, unsigned length);
+void *sbrk (intptr_t increment);
 
 /* Project 4 only. */
 bool chdir (const char *dir);
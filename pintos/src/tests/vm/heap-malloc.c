@@ -0,0 +1,69 @@
+/* Grows the heap with sbrk(), maps anonymous memory, and
+   allocates blocks of many sizes with malloc(), checking that
+   none of them overlap and that freed memory is reused. */
+
+#include <malloc.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ANON ((void *) 0x10000000)
+#define ANON_SIZE (64 * 4096)
+#define BLOCK_CNT 64
+
+static char *blocks[BLOCK_CNT];
+
+static size_t
+block_size (int i)
+{
+  return 1 + (i * 733) % (i % 4 == 0 ? 20000 : 1000);
+}
+
+void
+test_main (void)
+{
+  char *brk, *anon = ANON;
+  mapid_t map;
+  size_t i;
+  int j;
+
+  brk = sbrk (0);
+  CHECK (sbrk (8192) == brk, "grow heap by two pages");
+  memset (brk, 0x5a, 8192);
+  CHECK (sbrk (-8192) == brk + 8192, "shrink heap back");
+
+  CHECK ((map = mmap_anon (ANON, ANON_SIZE)) != MAP_FAILED,
+         "map anonymous memory");
+  for (i = 0; i < ANON_SIZE; i += 4096)
+    if (anon[i] != 0)
+      fail ("anonymous page %zu is not zeroed", i / 4096);
+  for (i = 0; i < ANON_SIZE; i++)
+    anon[i] = i % 251;
+  for (i = 0; i < ANON_SIZE; i++)
+    if (anon[i] != (char) (i % 251))
+      fail ("anonymous byte %zu changed", i);
+  munmap (map);
+  msg ("anonymous memory ok");
+
+  for (j = 0; j < BLOCK_CNT; j++)
+    {
+      blocks[j] = malloc (block_size (j));
+      if (blocks[j] == NULL)
+        fail ("malloc %zu bytes failed", block_size (j));
+      memset (blocks[j], j, block_size (j));
+    }
+  for (j = 0; j < BLOCK_CNT; j++)
+    for (i = 0; i < block_size (j); i++)
+      if (blocks[j][i] != j)
+        fail ("block %d overwritten", j);
+  msg ("allocated %d blocks", BLOCK_CNT);
+
+  for (j = 0; j < BLOCK_CNT; j++)
+    free (blocks[j]);
+  for (j = 0; j < BLOCK_CNT; j++)
+    blocks[j] = malloc (block_size (j));
+  for (j = 0; j < BLOCK_CNT; j++)
+    free (blocks[j]);
+  CHECK ((char *) sbrk (0) - brk < 512 * 1024, "freed blocks reused");
+}
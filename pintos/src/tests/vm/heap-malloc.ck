@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(heap-malloc) begin
+(heap-malloc) grow heap by two pages
+(heap-malloc) shrink heap back
+(heap-malloc) map anonymous memory
+(heap-malloc) anonymous memory ok
+(heap-malloc) allocated 64 blocks
+(heap-malloc) freed blocks reused
+(heap-malloc) end
+EOF
+pass;
@@ -0,0 +1,38 @@
+/* Gives access hints for a mapping.  Dropping its pages with
+   MADV_DONTNEED writes them back first, so they fault in again
+   from the file, whether read back directly or prefetched after
+   MADV_WILLNEED. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((void *) 0x10000000)
+
+void
+test_main (void)
+{
+  size_t size = strlen (sample);
+  int handle;
+  mapid_t map;
+
+  CHECK (create ("sample.txt", size), "create \"sample.txt\"");
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"sample.txt\"");
+  memcpy (ACTUAL, sample, size);
+
+  CHECK (madvise (ACTUAL, size, MADV_DONTNEED), "drop mapped pages");
+  CHECK (!memcmp (ACTUAL, sample, size), "compare data faulted back in");
+
+  CHECK (madvise (ACTUAL, size, MADV_SEQUENTIAL), "advise sequential");
+  CHECK (madvise (ACTUAL, size, MADV_DONTNEED), "drop mapped pages");
+  CHECK (madvise (ACTUAL, size, MADV_WILLNEED), "advise willneed");
+  CHECK (!memcmp (ACTUAL, sample, size), "compare prefetched data");
+
+  CHECK (!madvise ((char *) ACTUAL + 0x100000, 4096, MADV_RANDOM),
+         "reject unmapped range");
+  munmap (map);
+  close (handle);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-advise) begin
+(mmap-advise) create "sample.txt"
+(mmap-advise) open "sample.txt"
+(mmap-advise) mmap "sample.txt"
+(mmap-advise) drop mapped pages
+(mmap-advise) compare data faulted back in
+(mmap-advise) advise sequential
+(mmap-advise) drop mapped pages
+(mmap-advise) advise willneed
+(mmap-advise) compare prefetched data
+(mmap-advise) reject unmapped range
+(mmap-advise) end
+EOF
+pass;
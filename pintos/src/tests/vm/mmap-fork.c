@@ -0,0 +1,42 @@
+/* Forks a child of a process that maps a file.  The child
+   inherits the mapping and writes the file's data through it;
+   the write shows in the parent's mapping, and reaches the file
+   once the parent unmaps it. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x10000000)
+
+void
+test_main (void)
+{
+  size_t size = strlen (sample);
+  char buf[1024];
+  int handle;
+  mapid_t map;
+  pid_t pid;
+
+  CHECK (create ("sample.txt", size), "create \"sample.txt\"");
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"sample.txt\"");
+  ACTUAL[0] = 0;
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      memcpy (ACTUAL, sample, size);
+      exit (0);
+    }
+  CHECK (pid != PID_ERROR, "fork child");
+  CHECK (wait (pid) == 0, "wait for child");
+  CHECK (!memcmp (ACTUAL, sample, size), "compare child's data in mapping");
+  munmap (map);
+
+  read (handle, buf, size);
+  CHECK (!memcmp (buf, sample, size), "compare child's data in file");
+  close (handle);
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-fork) begin
+(mmap-fork) create "sample.txt"
+(mmap-fork) open "sample.txt"
+(mmap-fork) mmap "sample.txt"
+(mmap-fork) fork child
+(mmap-fork) wait for child
+(mmap-fork) compare child's data in mapping
+(mmap-fork) compare child's data in file
+(mmap-fork) end
+EOF
+pass;
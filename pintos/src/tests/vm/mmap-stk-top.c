@@ -0,0 +1,33 @@
+/* Maps a file within 8 MB below the top of user memory.  The
+   stack only reserves the pages it has grown into, so the mapping
+   succeeds, and the stack still grows above it. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((void *) 0xbfc00000)
+
+void
+test_main (void)
+{
+  char stk_obj[65536];
+  int handle;
+  mapid_t map;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED,
+         "mmap \"sample.txt\" below the stack");
+  if (memcmp (ACTUAL, sample, strlen (sample)))
+    fail ("read of mmap'd file reported bad data");
+
+  memset (stk_obj, 'a', sizeof stk_obj);
+  if (stk_obj[0] != 'a' || memcmp (ACTUAL, sample, strlen (sample)))
+    fail ("stack growth disturbed the mapping");
+  msg ("grow the stack");
+
+  munmap (map);
+  close (handle);
+}
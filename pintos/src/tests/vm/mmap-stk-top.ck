@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-stk-top) begin
+(mmap-stk-top) open "sample.txt"
+(mmap-stk-top) mmap "sample.txt" below the stack
+(mmap-stk-top) grow the stack
+(mmap-stk-top) end
+EOF
+pass;
@@ -0,0 +1,38 @@
+/* Forks a series of children that each overwrite part of a
+   large array and exit, and checks that the parent's copy of the
+   array is unaffected by any of them. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (128 * 1024)
+#define CHILD_CNT 16
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  size_t i;
+  int child;
+
+  memset (buf, 'p', SIZE);
+  for (child = 0; child < CHILD_CNT; child++)
+    {
+      pid_t pid = fork ();
+      if (pid == 0)
+        {
+          memset (buf + child % 2 * (SIZE / 2), 'c', SIZE / 2);
+          exit (child);
+        }
+      CHECK (pid != PID_ERROR, "fork child %d", child);
+      CHECK (wait (pid) == child, "wait for child %d", child);
+    }
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != 'p')
+      fail ("byte %zu of parent's copy changed to '%c'", i, buf[i]);
+  msg ("parent's copy intact");
+}
@@ -0,0 +1,42 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-fork) begin
+(page-fork) fork child 0
+(page-fork) wait for child 0
+(page-fork) fork child 1
+(page-fork) wait for child 1
+(page-fork) fork child 2
+(page-fork) wait for child 2
+(page-fork) fork child 3
+(page-fork) wait for child 3
+(page-fork) fork child 4
+(page-fork) wait for child 4
+(page-fork) fork child 5
+(page-fork) wait for child 5
+(page-fork) fork child 6
+(page-fork) wait for child 6
+(page-fork) fork child 7
+(page-fork) wait for child 7
+(page-fork) fork child 8
+(page-fork) wait for child 8
+(page-fork) fork child 9
+(page-fork) wait for child 9
+(page-fork) fork child 10
+(page-fork) wait for child 10
+(page-fork) fork child 11
+(page-fork) wait for child 11
+(page-fork) fork child 12
+(page-fork) wait for child 12
+(page-fork) fork child 13
+(page-fork) wait for child 13
+(page-fork) fork child 14
+(page-fork) wait for child 14
+(page-fork) fork child 15
+(page-fork) wait for child 15
+(page-fork) parent's copy intact
+(page-fork) end
+EOF
+pass;
@@ -15,6 +15,7 @@
 #include "devices/timer.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
@@ -49,6 +50,9 @@ void strip_extra_spaces(const char* str);
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
 
+/* True if the CPU can map 4 MB pages. */
+bool init_large_pages;
+
 #ifdef FILESYS
 /* -f: Format the file system? */
 static bool format_filesys;
@@ -67,6 +71,7 @@ static size_t user_page_limit = SIZE_MAX;
 
 static void bss_init(void);
 static void paging_init(void);
+static uint32_t cpu_features(void);
 
 static char **read_command_line(void);
 static char **parse_options(char **argv);
@@ -126,6 +131,7 @@ int main(void)
 	thread_start();
 	serial_init_queue();
 	timer_calibrate();
+	palloc_start_zeroer();
 
 #ifdef FILESYS
 	/* Initialize file system. */
@@ -169,6 +175,11 @@ static void paging_init(void)
 	uint32_t *pd, *pt;
 	size_t page;
 	extern char _start, _end_kernel_text;
+	uint32_t features = cpu_features();
+	uint32_t global = features & CPUID_PGE ? PTE_G : 0;
+	uint32_t cr4;
+
+	init_large_pages = (features & CPUID_PSE) != 0;
 
 	pd = init_page_dir = palloc_get_page(PAL_ASSERT | PAL_ZERO);
 	pt = NULL;
@@ -180,13 +191,26 @@ static void paging_init(void)
 		size_t pte_idx = pt_no(vaddr);
 		bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+		//whole 4 MB chunks of RAM without kernel text (which stays
+		//read-only page by page) take a single large PDE
+		if (init_large_pages && pte_idx == 0
+				&& page + (1 << PTBITS) <= init_ram_pages
+				&& (vaddr + PTSPAN <= &_start || &_end_kernel_text <= vaddr))
+		{
+			pd[pde_idx] = paddr | PTE_PS | global | PTE_P | PTE_W;
+			page += (1 << PTBITS) - 1;
+			continue;
+		}
+
 		if (pd[pde_idx] == 0)
 		{
 			pt = palloc_get_page(PAL_ASSERT | PAL_ZERO);
 			pd[pde_idx] = pde_create(pt);
 		}
 
-		pt[pte_idx] = pte_create_kernel(vaddr, !in_kernel_text);
+		//the kernel mapping is the same in every page directory, so its
+		//translations need not be flushed on a process switch
+		pt[pte_idx] = pte_create_kernel(vaddr, !in_kernel_text) | global;
 	}
 
 	/* Store the physical address of the page directory into CR3
@@ -194,7 +218,39 @@ static void paging_init(void)
 	 new page tables immediately.  See [IA32-v2a] "MOV--Move
 	 to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
 	 of the Page Directory". */
+	if (init_large_pages)
+	{
+		asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+		asm volatile ("movl %0, %%cr4" : : "r" (cr4 | CR4_PSE) : "memory");
+	}
 	asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
+
+	//honour PTE_G from now on
+	if (global)
+	{
+		asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+		asm volatile ("movl %0, %%cr4" : : "r" (cr4 | CR4_PGE) : "memory");
+	}
+}
+
+/* Returns the feature flags that CPUID reports in EDX for leaf
+ 1, or 0 if the CPU has no CPUID instruction.  See [IA32-v2a]
+ "CPUID--CPU Identification". */
+static uint32_t cpu_features(void)
+{
+	uint32_t flags, toggled, eax, ebx, ecx, edx;
+
+	//CPUID exists if the ID flag can be changed
+	asm volatile ("pushfl; popl %0" : "=r" (flags));
+	asm volatile ("pushl %1; popfl; pushfl; popl %0"
+			: "=r" (toggled) : "r" (flags ^ FLAG_ID) : "cc");
+	asm volatile ("pushl %0; popfl" : : "r" (flags) : "cc");
+	if (((flags ^ toggled) & FLAG_ID) == 0)
+		return 0;
+
+	asm volatile ("cpuid"
+			: "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+	return edx;
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -260,6 +316,10 @@ parse_options(char **argv)
 		else if (!strcmp (name, "-swap"))
 		swap_bdev_name = value;
 #endif
+#ifdef P4FILESYS
+		else if (!strcmp(name, "-bufsize"))
+			buffer_size = atoi(value);
+#endif
 #endif
 		else if (!strcmp(name, "-rs"))
 			random_init(atoi(value));
@@ -268,6 +328,16 @@ parse_options(char **argv)
 #ifdef USERPROG
 		else if (!strcmp(name, "-ul"))
 			user_page_limit = atoi(value);
+#endif
+#ifdef VM
+		else if (!strcmp(name, "-rss"))
+			vm_rss_limit = atoi(value);
+		else if (!strcmp(name, "-ksm"))
+			vm_ksm_rate = atoi(value);
+		else if (!strcmp(name, "-evict"))
+			vm_evict_name = value;
+		else if (!strcmp(name, "-swaps"))
+			vm_swap_names = value;
 #endif
 		else
 			PANIC("unknown option `%s' (use -h for help)", name);
@@ -400,11 +470,20 @@ static void usage(void)
 #ifdef VM
 			"  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
+#ifdef P4FILESYS
+			"  -bufsize=COUNT     Cache COUNT file system sectors.\n"
+#endif
 #endif
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -rss=COUNT         Limit each process to COUNT resident pages.\n"
+			"  -ksm=RATE          Merge identical pages, scanning RATE a second.\n"
+			"  -evict=POLICY      Replace pages with clock, aging, wsclock or 2q.\n"
+			"  -swaps=DEV,...     Stripe swap over DEVs (e.g. hdc,hdd).\n"
 #endif
 			);
 	shutdown_power_off();
@@ -9,6 +9,7 @@
 #include <string.h>
 #include "threads/loader.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -23,7 +24,19 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   When the CPU has nothing better to do, a "zeroer" thread takes
+   free pages from each pool, zeroes them and keeps them on the
+   pool's ready list, so that PAL_ZERO requests for one page get
+   a page without a memset on their path.  Ready pages are marked
+   used in the bitmap.  They are still handed out to requests that
+   do not need them zeroed when the bitmap has no free page left,
+   and given back to the bitmap when a multi-page request finds
+   no room, so the ready list never makes an allocation fail. */
+
+/* Zeroed pages the zeroer keeps ready in each pool. */
+#define READY_PAGES 32
 
 /* A memory pool. */
 struct pool
@@ -31,14 +44,28 @@ struct pool
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
     uint8_t *base;                      /* Base of pool. */
+    void *ready;                        /* Zeroed pages, linked through
+                                           their first word. */
+    size_t ready_cnt;                   /* Number of ready pages. */
+    long long hit_cnt;                  /* PAL_ZERO pages from ready list. */
+    long long miss_cnt;                 /* PAL_ZERO pages zeroed on demand. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
+/* The zeroer sleeps on ZEROER_SEMA once the ready lists are full
+   or the pools have no free page left. */
+static struct semaphore zeroer_sema;
+static bool zeroer_asleep;
+
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static void *ready_pop (struct pool *);
+static void ready_drain (struct pool *);
+static void zeroer_wake (const struct pool *);
+static void zeroer (void *aux);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -61,6 +88,18 @@ palloc_init (size_t user_page_limit)
              user_pages, "user pool");
 }
 
+/* Starts the thread that keeps the pools' ready lists filled.
+   It runs at the lowest priority, so only when the CPU would
+   otherwise be idle.  Under -mlfqs, where priorities are
+   recomputed from nice and recent_cpu, it takes the highest nice
+   value instead, so that it gives way to the other threads. */
+void
+palloc_start_zeroer (void)
+{
+  sema_init (&zeroer_sema, 0);
+  thread_create ("zeroer", PRI_MIN, zeroer, NULL);
+}
+
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
    If PAL_USER is set, the pages are obtained from the user pool,
    otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
@@ -78,7 +117,28 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
     return NULL;
 
   lock_acquire (&pool->lock);
+  if (page_cnt == 1 && (flags & PAL_ZERO) && pool->ready != NULL)
+    {
+      pages = ready_pop (pool);
+      pool->hit_cnt++;
+      lock_release (&pool->lock);
+      return pages;
+    }
   page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+  if (page_idx == BITMAP_ERROR && pool->ready != NULL)
+    {
+      /* The free pages left are all on the ready list. */
+      if (page_cnt == 1)
+        {
+          pages = ready_pop (pool);
+          lock_release (&pool->lock);
+          return pages;
+        }
+      ready_drain (pool);
+      page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+    }
+  if (page_cnt == 1 && (flags & PAL_ZERO))
+    pool->miss_cnt++;
   lock_release (&pool->lock);
 
   if (page_idx != BITMAP_ERROR)
@@ -100,6 +160,49 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   return pages;
 }
 
+/* Obtains and returns a group of PAGE_CNT contiguous free pages
+   whose physical address is a multiple of PAGE_CNT pages, which
+   must be a power of 2.  Such a group can back a 4 MB page when
+   PAGE_CNT is 1024.  FLAGS are interpreted as for
+   palloc_get_multiple(). */
+void *
+palloc_get_aligned (enum palloc_flags flags, size_t page_cnt)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  size_t pool_cnt = bitmap_size (pool->used_map);
+  void *pages = NULL;
+  size_t page_idx;
+
+  ASSERT (page_cnt != 0 && (page_cnt & (page_cnt - 1)) == 0);
+
+  /* First index whose physical page number is aligned. */
+  page_idx = (page_cnt - vtop (pool->base) / PGSIZE % page_cnt) % page_cnt;
+
+  lock_acquire (&pool->lock);
+  ready_drain (pool);
+  for (; page_idx + page_cnt <= pool_cnt; page_idx += page_cnt)
+    if (bitmap_none (pool->used_map, page_idx, page_cnt))
+      {
+        bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+        pages = pool->base + PGSIZE * page_idx;
+        break;
+      }
+  lock_release (&pool->lock);
+
+  if (pages != NULL) 
+    {
+      if (flags & PAL_ZERO)
+        memset (pages, 0, PGSIZE * page_cnt);
+    }
+  else 
+    {
+      if (flags & PAL_ASSERT)
+        PANIC ("palloc_get: out of pages");
+    }
+
+  return pages;
+}
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
@@ -139,6 +242,7 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  zeroer_wake (pool);
 }
 
 /* Frees the page at PAGE. */
@@ -148,6 +252,103 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Prints the ready list statistics. */
+void
+palloc_print_stats (void)
+{
+  printf ("Palloc: zeroed pages from ready lists: %lld kernel, %lld user; "
+          "zeroed on demand: %lld kernel, %lld user\n",
+          kernel_pool.hit_cnt, user_pool.hit_cnt,
+          kernel_pool.miss_cnt, user_pool.miss_cnt);
+}
+
+/* Takes a page off POOL's ready list, which must not be empty,
+   and returns it with its link cleared.  POOL's lock must be
+   held.  Wakes up the zeroer when the list runs low. */
+static void *
+ready_pop (struct pool *pool)
+{
+  void **page = pool->ready;
+
+  ASSERT (page != NULL);
+  pool->ready = *page;
+  *page = NULL;
+  pool->ready_cnt--;
+  zeroer_wake (pool);
+  return page;
+}
+
+/* Gives the pages on POOL's ready list back to its bitmap.
+   POOL's lock must be held. */
+static void
+ready_drain (struct pool *pool)
+{
+  while (pool->ready != NULL)
+    {
+      void **page = pool->ready;
+      pool->ready = *page;
+      pool->ready_cnt--;
+      bitmap_reset (pool->used_map, pg_no (page) - pg_no (pool->base));
+    }
+}
+
+/* Fills the ready list of POOL up to READY_PAGES, one page at a
+   time so that the pool's lock is not held while zeroing.
+   Returns false if the pool had no free page to zero. */
+static bool
+ready_fill (struct pool *pool)
+{
+  while (pool->ready_cnt < READY_PAGES)
+    {
+      size_t page_idx;
+      void **page;
+
+      lock_acquire (&pool->lock);
+      page_idx = bitmap_scan_and_flip (pool->used_map, 0, 1, false);
+      lock_release (&pool->lock);
+      if (page_idx == BITMAP_ERROR)
+        return false;
+
+      page = (void **) (pool->base + PGSIZE * page_idx);
+      memset (page, 0, PGSIZE);
+
+      lock_acquire (&pool->lock);
+      *page = pool->ready;
+      pool->ready = page;
+      pool->ready_cnt++;
+      lock_release (&pool->lock);
+    }
+  return true;
+}
+
+/* Wakes up the zeroer if it sleeps and POOL's ready list is
+   less than half full. */
+static void
+zeroer_wake (const struct pool *pool)
+{
+  if (zeroer_asleep && pool->ready_cnt < READY_PAGES / 2)
+    {
+      zeroer_asleep = false;
+      sema_up (&zeroer_sema);
+    }
+}
+
+/* The zeroer thread.  Refills the ready lists, then sleeps until
+   one of them runs low. */
+static void
+zeroer (void *aux UNUSED)
+{
+  if (thread_mlfqs)
+    thread_set_nice (20);
+  for (;;)
+    {
+      ready_fill (&kernel_pool);
+      ready_fill (&user_pool);
+      zeroer_asleep = true;
+      sema_down (&zeroer_sema);
+    }
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
@@ -165,6 +366,9 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
 
   /* Initialize the pool. */
   lock_init (&p->lock);
+  p->ready = NULL;
+  p->ready_cnt = 0;
+  p->hit_cnt = p->miss_cnt = 0;
   p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
   p->base = base + bm_pages * PGSIZE;
 }
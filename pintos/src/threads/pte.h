@@ -66,6 +66,18 @@ static inline uintptr_t pd_no (const void *va) {
 #define PTE_U 0x4               /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20              /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40              /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80             /* 1=maps a 4 MB page (PDEs only, needs
+                                   CR4_PSE), 0=points to a page table. */
+#define PTE_G 0x100             /* 1=global, kept in the TLB across CR3
+                                   reloads (PTEs only, needs CR4_PGE). */
+
+/* CR4 bits that enable 4 MB pages and global pages. */
+#define CR4_PSE 0x10
+#define CR4_PGE 0x80
+
+/* CPUID.01H:EDX bits that report support for them. */
+#define CPUID_PSE 0x8
+#define CPUID_PGE 0x2000
 
 /* Returns a PDE that points to page table PT. */
 static inline uint32_t pde_create (uint32_t *pt) {
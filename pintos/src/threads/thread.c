@@ -15,6 +15,9 @@
 #include "userprog/process.h"
 #endif
 #include "devices/timer.h"
+#ifdef VM
+#include "vm/vma.h"
+#endif
 
 /* Random value for struct thread's `magic' member.
  Used to detect stack overflow.  See the big comment at the top
@@ -237,24 +240,8 @@ tid_t thread_create(const char *name, int priority, thread_func *function,
 	sf->eip = switch_entry;
 	sf->ebp = 0;
 
-	/* Add to run queue. */
-	thread_unblock(t);
-
-	//If newly created thread has higher priority than the current thread under
-	//execution, then yield it and hopefully[:)] run the new thread
-	//--
-	//In case of Advanced scheduler, do not yield the current thread
-	//immediately, instead let the scheduler decide at a later stage
-	if (!thread_mlfqs)
-	{
-		if (priority > thread_current()->priority)
-		{
-			thread_yield();
-		}
-	}
-
 #ifdef USERPROG
-
+	//set up before the thread can run, a forked child uses these at once
 	sema_init(&t->sema_process_wait, 0);
 	sema_init(&t->sema_process_load, 0);
 	sema_init(&t->sema_process_exit, 0);
@@ -269,6 +256,15 @@ tid_t thread_create(const char *name, int priority, thread_func *function,
 #ifdef VM
 	list_init(&t->mmap_files);
 	list_init(&t->children);
+	tree_init(&t->vmas, vma_less_helper, NULL);
+	t->rss = t->rss_limit = t->wss = 0;
+	t->wss_tick = 0;
+	list_init(&t->prefetched);
+	t->prefetch_cnt = 0;
+	t->fault_flags = 0;
+	memset(t->fault_cnt, 0, sizeof t->fault_cnt);
+	t->heap_start = t->brk = NULL;
+	t->compact_cnt = 0;
 	if (cur != initial_thread)
 	list_push_front(&cur->children, &t->child_elem);
 #endif
@@ -280,6 +276,22 @@ tid_t thread_create(const char *name, int priority, thread_func *function,
 
 #endif
 
+	/* Add to run queue. */
+	thread_unblock(t);
+
+	//If newly created thread has higher priority than the current thread under
+	//execution, then yield it and hopefully[:)] run the new thread
+	//--
+	//In case of Advanced scheduler, do not yield the current thread
+	//immediately, instead let the scheduler decide at a later stage
+	if (!thread_mlfqs)
+	{
+		if (priority > thread_current()->priority)
+		{
+			thread_yield();
+		}
+	}
+
 	return tid;
 }
 
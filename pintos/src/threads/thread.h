@@ -4,11 +4,15 @@
 #include <debug.h>
 #include <list.h>
 #include <hash.h>
+#include <tree.h>
 #include <stdint.h>
 #include "threads/synch.h"
 #include "filesys/file.h"
 
 #include "filesys/filesys.h"
+#ifdef VM
+#include "userprog/fault.h"
+#endif
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -29,6 +33,18 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+#ifdef USERPROG
+//a TLB batch invalidates up to this many pages one by one, more are flushed
+//all at once
+#define TLB_BATCH_PAGES 16
+#endif
+
+#ifdef VM
+//pages evicted from a process that it turns into compact page table entries
+//the next time it enters the kernel
+#define COMPACT_PAGES 32
+#endif
+
 /* A kernel thread or user process.
 
  Each thread structure is stored in its own 4 kB page.  The
@@ -101,6 +117,9 @@ struct thread
 #ifdef USERPROG
 	/* Owned by userprog/process.c. */
 	uint32_t *pagedir; /* Page directory. */
+	int tlb_batch; //nesting depth of pagedir_batch_begin()
+	int tlb_pending; //TLB invalidations deferred by the batch
+	void *tlb_pages[TLB_BATCH_PAGES]; //the first pages deferred
 
 	/****************************************************************************/
 	//The following members are required for implementing project 2
@@ -125,6 +144,21 @@ struct thread
 	struct list mmap_files;
 	struct list children;
 	struct list_elem child_elem;
+	void *fault_next; //page a sequential file fault would hit next
+	int fault_window; //pages mapped around the next file fault
+	struct tree vmas; //regions of the address space, by start address
+	int rss; //frames mapped by the process, the zero frame aside
+	int rss_limit; //rss from which the process evicts its own pages, 0 if none
+	int wss; //pages accessed during the last sampling interval
+	int64_t wss_tick; //timer tick of the last working-set sample
+	struct list prefetched; //pages the prefetch thread has read for us
+	int prefetch_cnt; //prefetches queued, being read or read for us
+	int fault_flags; //FAULT_EVICT etc. bits the current fault ran into
+	long long fault_cnt[FAULT_CLASS_CNT]; //page faults of the process by class
+	void *heap_start; //first page above the executable, where the heap starts
+	void *brk; //end of the heap, moved by sbrk
+	void *compact_pages[COMPACT_PAGES]; //evicted anonymous pages to compact
+	int compact_cnt; //entries of compact_pages in use
 #endif
 
 	/* Owned by thread.c. */
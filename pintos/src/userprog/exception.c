@@ -6,13 +6,44 @@
 #include "threads/thread.h"
 #include "userprog/syscall.h"
 #include "threads/vaddr.h"
+#include "userprog/pagedir.h"
 
 #include "vm/struct.h"
 #include "threads/pte.h"
+#include <string.h>
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
+#ifdef VM
+//a fault class histogram has a bucket per power of 2 of TSC cycles
+#define FAULT_HIST_BUCKETS 40
+
+//exited processes with their own row in the per-process fault table, the
+//last row sums up all later ones
+#define FAULT_PROC_MAX 32
+
+static const char *fault_class_names[FAULT_CLASS_CNT] =
+{ "zero", "file", "swap", "stack", "cow", "shared", "evict", "wback" };
+
+static long long fault_class_cnt[FAULT_CLASS_CNT]; //faults by class
+static long long fault_class_cycles[FAULT_CLASS_CNT]; //their total latency
+static long long fault_hist[FAULT_CLASS_CNT][FAULT_HIST_BUCKETS];
+
+//the fault counts of an exited process
+struct fault_proc
+{
+	char name[16]; //name of the process
+	tid_t tid; //its thread
+	long long cnt[FAULT_CLASS_CNT]; //its faults by class
+};
+static struct fault_proc fault_procs[FAULT_PROC_MAX];
+static int fault_proc_cnt;
+
+static uint64_t rdtsc(void);
+static void fault_account(enum fault_class class, uint64_t start);
+#endif
+
 static void kill(struct intr_frame *);
 static void page_fault(struct intr_frame *);
 
@@ -68,8 +99,105 @@ void exception_init(void)
 void exception_print_stats(void)
 {
 	printf("Exception: %lld page faults\n", page_fault_cnt);
+#ifdef VM
+	int c, b, p;
+
+	printf("Page faults by class: count, mean TSC cycles, "
+			"histogram of log2 cycles\n");
+	for (c = 0; c < FAULT_CLASS_CNT; c++)
+	{
+		if (fault_class_cnt[c] == 0)
+			continue;
+		printf("  %-6s %8lld %10lld ", fault_class_names[c], fault_class_cnt[c],
+				fault_class_cycles[c] / fault_class_cnt[c]);
+		for (b = 0; b < FAULT_HIST_BUCKETS; b++)
+			if (fault_hist[c][b] != 0)
+				printf(" %d:%lld", b, fault_hist[c][b]);
+		printf("\n");
+	}
+
+	if (fault_proc_cnt > 0)
+	{
+		printf("Page faults by process:\n  %-20s", "");
+		for (c = 0; c < FAULT_CLASS_CNT; c++)
+			printf(" %6s", fault_class_names[c]);
+		printf("\n");
+		for (p = 0; p < fault_proc_cnt; p++)
+		{
+			if (p == FAULT_PROC_MAX - 1 && fault_proc_cnt == FAULT_PROC_MAX)
+				printf("  %-20s", "(all later)");
+			else
+				printf("  %-15s %4d", fault_procs[p].name, fault_procs[p].tid);
+			for (c = 0; c < FAULT_CLASS_CNT; c++)
+				printf(" %6lld", fault_procs[p].cnt[c]);
+			printf("\n");
+		}
+	}
+#endif
+	pagedir_print_stats();
+#ifdef VM
+	VM_print_stats();
+#endif
 }
 
+#ifdef VM
+//keeps the fault counts of the exiting process T for exception_print_stats()
+void exception_save_process(struct thread *t)
+{
+	struct fault_proc *fp;
+	enum intr_level old_level;
+	int c;
+
+	old_level = intr_disable();
+	if (fault_proc_cnt < FAULT_PROC_MAX)
+	{
+		fp = &fault_procs[fault_proc_cnt++];
+		strlcpy(fp->name, t->name, sizeof fp->name);
+		fp->tid = t->tid;
+	}
+	else
+		fp = &fault_procs[FAULT_PROC_MAX - 1];
+	for (c = 0; c < FAULT_CLASS_CNT; c++)
+		fp->cnt[c] += t->fault_cnt[c];
+	intr_set_level(old_level);
+}
+
+//reads the CPU's time-stamp counter
+static uint64_t rdtsc(void)
+{
+	uint32_t lo, hi;
+	asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t) hi << 32) | lo;
+}
+
+//counts a handled fault of CLASS that started at TSC START, along with the
+//evictions and write-backs it ran into
+static void fault_account(enum fault_class class, uint64_t start)
+{
+	struct thread *t = thread_current();
+	uint64_t cycles = rdtsc() - start;
+	enum intr_level old_level;
+	int bucket = 0, c;
+
+	if (class == FAULT_FILE && (t->fault_flags & (1 << FAULT_SHARED)))
+		class = FAULT_SHARED;
+	while ((cycles >> bucket) > 1 && bucket < FAULT_HIST_BUCKETS - 1)
+		bucket++;
+
+	old_level = intr_disable();
+	for (c = 0; c < FAULT_CLASS_CNT; c++)
+		if (c == (int) class
+				|| (c >= FAULT_EVICT && (t->fault_flags & (1 << c))))
+		{
+			fault_class_cnt[c]++;
+			fault_class_cycles[c] += cycles;
+			fault_hist[c][bucket]++;
+			t->fault_cnt[c]++;
+		}
+	intr_set_level(old_level);
+}
+#endif
+
 /* Handler for an exception (probably) caused by a user process. */
 static void kill(struct intr_frame *f)
 {
@@ -130,6 +258,9 @@ static void page_fault(struct intr_frame *f)
 
 #ifdef VM
 	void *fault_page; //Fault pg
+	uint64_t start = rdtsc();
+	enum fault_class class;
+	bool success;
 #endif
 
 	/* Obtain faulting address, the virtual address that was
@@ -166,15 +297,53 @@ static void page_fault(struct intr_frame *f)
 	fault_page = PTE_ADDR & (uint32_t) fault_addr;
 
 	struct page_struct *page;
+	if (user)
+		VM_compact_pages();
+	VM_sample_wss();
+	thread_current()->fault_flags = 0;
 	page = VM_find_page(fault_page);
 
 	if (page != NULL)
 	{
 		if (write && !page->writable)
 			system_call_exit(-1);
-		bool success = VM_operation_page(OP_LOAD, page, page->physical_address, false);
+		//the only protection fault allowed is a write to a copy-on-write page
+		if (!not_present)
+		{
+			if (write && page->cow && VM_cow_break(page, false))
+			{
+				fault_account(FAULT_COW, start);
+				return;
+			}
+			system_call_exit(-1);
+		}
+		if (page->type == TYPE_FILE && !page->loaded)
+		{
+			class = FAULT_FILE;
+			success = VM_fault_around(page);
+		}
+		else if (page->type == TYPE_ZERO && !write)
+		{
+			class = FAULT_ZERO;
+			success = VM_map_zero(page);
+		}
+		else if (page->type == TYPE_ZERO && !page->loaded
+				&& VM_map_large(page))
+		{
+			class = FAULT_ZERO;
+			success = true;
+		}
+		else
+		{
+			class = page->type == TYPE_SWAP ? FAULT_SWAP : FAULT_ZERO;
+			success = VM_operation_page(OP_LOAD, page, page->physical_address,
+					false);
+		}
 		if (success)
+		{
+			fault_account(class, start);
 			return;
+		}
 		else
 			system_call_exit(-1);
 	}
@@ -185,7 +354,10 @@ static void page_fault(struct intr_frame *f)
 	{
 		struct page_struct *temp = VM_stack_grow(fault_page, false);
 		if (temp != NULL)
+		{
+			fault_account(FAULT_STACK, start);
 			return;
+		}
 		else
 			system_call_exit(-1);
 
@@ -0,0 +1,24 @@
+#ifndef USERPROG_FAULT_H
+#define USERPROG_FAULT_H
+
+/* Page fault classes, for profiling.  A fault is counted in
+   exactly one of the first six classes, and also in FAULT_EVICT
+   and FAULT_WRITEBACK if it had to evict or write a page out. */
+enum fault_class
+  {
+    FAULT_ZERO,                 /* Zero-filled page. */
+    FAULT_FILE,                 /* Page read from a file. */
+    FAULT_SWAP,                 /* Page read back from swap. */
+    FAULT_STACK,                /* Stack growth. */
+    FAULT_COW,                  /* Copy-on-write break. */
+    FAULT_SHARED,               /* Mapped to another process's frame. */
+    FAULT_EVICT,                /* Had to evict a frame. */
+    FAULT_WRITEBACK,            /* Wrote an evicted page out. */
+    FAULT_CLASS_CNT
+  };
+
+struct thread;
+
+void exception_save_process (struct thread *);
+
+#endif /* userprog/fault.h */
@@ -2,16 +2,31 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <string.h>
+#include <stdio.h>
 #include "threads/init.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
+#include "threads/thread.h"
 
 #ifdef VM
 #include "vm/struct.h"
 #endif
 
+/* Software bit of a present PTE or 4 MB PDE: the page was accessed
+ before pagedir_sample_accessed() last cleared PTE_A, and page
+ replacement has not seen that yet.  Sampling thus leaves the
+ reference information of replacement intact. */
+#define PTE_REF 0x200
+
 static uint32_t *active_pd(void);
 static void invalidate_pagedir(uint32_t *);
+static void invalidate_page(uint32_t *, const void *);
+static uint32_t *lookup_large(uint32_t *, const void *);
+
+static long long tlb_flush_cnt; /* Full TLB flushes. */
+static long long tlb_page_cnt; /* Single-page TLB invalidations. */
+static long long large_map_cnt; /* 4 MB pages mapped. */
+static long long large_split_cnt; /* 4 MB pages split into 4 kB PTEs. */
 
 /* Creates a new page directory that has mappings for kernel
  virtual addresses, but none for user virtual addresses.
@@ -36,40 +51,30 @@ void pagedir_destroy(uint32_t *pd)
 		return;
 
 	ASSERT(pd != init_page_dir);
+#ifdef VM
+	//the user pages go in one batched walk, which leaves the page tables
+	VM_free_pages(pd);
+#endif
 	for (pde = pd; pde < pd + pd_no(PHYS_BASE); pde++)
-		if (*pde & PTE_P)
+		if ((*pde & PTE_P) && (*pde & PTE_PS) == 0)
 		{
 			uint32_t *pt = pde_get_pt(*pde);
+#ifndef VM
 			uint32_t *pte;
 
 			for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
 				if (*pte & PTE_P)
-				{
-#ifndef VM
 					palloc_free_page (pte_get_page (*pte));
-#else
-					VM_free_frame(pte_get_page(*pte), pd);
-#endif
-				}
-#ifndef VM
-				palloc_free_page (pt);
-#else
-				else if (*pte != 0)
-					VM_operation_page(OP_FREE, (struct page_struct *) *pte,
-					NULL,
-					NULL);
-			VM_free_frame(pt, pd);
 #endif
+			palloc_free_page (pt);
 		}
-#ifndef VM
 	palloc_free_page (pd);
-#else
-	VM_free_frame(pd, pd);
-#endif
 }
 
 /* Returns the address of the page table entry for virtual
- address VADDR in page directory PD.
+ address VADDR in page directory PD.  A 4 MB page covering
+ VADDR is split first, so that the entry can be changed on its
+ own; if that fails, a null pointer is returned.
  If PD does not have a page table for VADDR, behavior depends
  on CREATE.  If CREATE is true, then a new page table is
  created and a pointer into it is returned.  Otherwise, a null
@@ -87,6 +92,8 @@ lookup_page(uint32_t *pd, const void *vaddr, bool create)
 	/* Check for a page table for VADDR.
 	 If one is missing, create one if requested. */
 	pde = pd + pd_no(vaddr);
+	if ((*pde & PTE_PS) && !pagedir_split(pd, vaddr))
+		return NULL;
 	if (*pde == 0)
 	{
 		if (create)
@@ -106,6 +113,78 @@ lookup_page(uint32_t *pd, const void *vaddr, bool create)
 	return &pt[pt_no(vaddr)];
 }
 
+/* Returns the PDE for user virtual address VADDR in PD if it
+ maps a 4 MB page, otherwise a null pointer. */
+static uint32_t *
+lookup_large(uint32_t *pd, const void *vaddr)
+{
+	uint32_t *pde = pd + pd_no(vaddr);
+	return (*pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS) ? pde : NULL;
+}
+
+/* Replaces the 4 MB page that maps VADDR in PD, if any, by a
+ page table of 1024 equivalent 4 kB PTEs, keeping the
+ accessed and dirty bits.  Returns false if no page table could
+ be allocated. */
+bool pagedir_split(uint32_t *pd, const void *vaddr)
+{
+	uint32_t *pde = lookup_large(pd, vaddr);
+	uint32_t *pt;
+	uint32_t paddr, flags;
+	size_t i;
+
+	if (pde == NULL)
+		return true;
+
+	pt = palloc_get_page(0);
+	if (pt == NULL)
+		return false;
+
+	paddr = *pde & PDMASK;
+	flags = *pde & (PTE_P | PTE_W | PTE_U | PTE_A | PTE_D | PTE_REF);
+	for (i = 0; i < 1 << PTBITS; i++)
+		pt[i] = (paddr + i * PGSIZE) | flags;
+	*pde = pde_create(pt);
+
+	//one invlpg anywhere in the large page drops its TLB entry
+	invalidate_page(pd, vaddr);
+	large_split_cnt++;
+	return true;
+}
+
+/* Maps the 4 MB of user virtual memory at UPAGE in PD to the
+ physically contiguous frames at KPAGE with a single PDE.  Both
+ addresses must be 4 MB aligned.  No page in the range may be
+ present; a page table left over for the range is freed, along
+ with whatever non-present entries it still holds.  Returns
+ false if the range is in use. */
+bool pagedir_set_large(uint32_t *pd, void *upage, void *kpage, bool writable)
+{
+	uint32_t *pde = pd + pd_no(upage);
+	uint32_t *pt;
+	size_t i;
+
+	ASSERT(((uintptr_t) upage & ~PDMASK) == 0);
+	ASSERT((vtop (kpage) & ~PDMASK) == 0);
+	ASSERT(is_user_vaddr(upage));
+	ASSERT(pd != init_page_dir);
+
+	if (*pde & PTE_PS)
+		return false;
+	if (*pde != 0)
+	{
+		pt = pde_get_pt(*pde);
+		for (i = 0; i < 1 << PTBITS; i++)
+			if (pt[i] & PTE_P)
+				return false;
+		palloc_free_page(pt);
+	}
+
+	*pde = vtop (kpage) | PTE_PS | PTE_U | PTE_P | (writable ? PTE_W : 0);
+	large_map_cnt++;
+	return true;
+}
+
 /* Adds a mapping in page directory PD from user virtual page
  UPAGE to the physical frame identified by kernel virtual
  address KPAGE.
@@ -149,6 +228,10 @@ pagedir_get_page(uint32_t *pd, const void *uaddr)
 
 	ASSERT(is_user_vaddr(uaddr));
 
+	pte = lookup_large(pd, uaddr);
+	if (pte != NULL)
+		return ptov(*pte & PDMASK) + ((uintptr_t) uaddr & ~PDMASK);
+
 	pte = lookup_page(pd, uaddr, false);
 	if (pte != NULL && (*pte & PTE_P) != 0)
 		return pte_get_page(*pte) + pg_ofs(uaddr);
@@ -171,14 +254,17 @@ void pagedir_clear_page(uint32_t *pd, void *upage)
 #ifdef VM
 	if (pte != NULL)
 	{
+		//the TLB only caches present entries
+		bool present = (*pte & PTE_P) != 0;
 		*pte &= 0;
-		invalidate_pagedir(pd);
+		if (present)
+			invalidate_page(pd, upage);
 	}
 #else
 	if (pte != NULL && (*pte & PTE_P) != 0)
 	{
 		*pte &= ~PTE_P;
-		invalidate_pagedir(pd);
+		invalidate_page(pd, upage);
 	}
 #endif
 }
@@ -189,23 +275,27 @@ void pagedir_clear_page(uint32_t *pd, void *upage)
  Returns false if PD contains no PTE for VPAGE. */
 bool pagedir_is_dirty(uint32_t *pd, const void *vpage)
 {
-	uint32_t *pte = lookup_page(pd, vpage, false);
+	uint32_t *pte = lookup_large(pd, vpage);
+	if (pte == NULL)
+		pte = lookup_page(pd, vpage, false);
 	return pte != NULL && (*pte & PTE_D) != 0;
 }
 
 /* Set the dirty bit to DIRTY in the PTE for virtual page VPAGE
- in PD. */
+ in PD.  Cleaning a page inside a 4 MB page splits it. */
 void pagedir_set_dirty(uint32_t *pd, const void *vpage, bool dirty)
 {
-	uint32_t *pte = lookup_page(pd, vpage, false);
+	uint32_t *pte = dirty ? lookup_large(pd, vpage) : NULL;
+	if (pte == NULL)
+		pte = lookup_page(pd, vpage, false);
 	if (pte != NULL)
 	{
 		if (dirty)
 			*pte |= PTE_D;
-		else
+		else if (*pte & PTE_D)
 		{
 			*pte &= ~(uint32_t) PTE_D;
-			invalidate_pagedir(pd);
+			invalidate_page(pd, vpage);
 		}
 	}
 }
@@ -216,25 +306,88 @@ void pagedir_set_dirty(uint32_t *pd, const void *vpage, bool dirty)
  PD contains no PTE for VPAGE. */
 bool pagedir_is_accessed(uint32_t *pd, const void *vpage)
 {
-	uint32_t *pte = lookup_page(pd, vpage, false);
-	return pte != NULL && (*pte & PTE_A) != 0;
+	uint32_t *pte = lookup_large(pd, vpage);
+	if (pte == NULL)
+		pte = lookup_page(pd, vpage, false);
+	return pte != NULL && ((*pte & PTE_A) != 0
+			|| (*pte & (PTE_P | PTE_REF)) == (PTE_P | PTE_REF));
 }
 
 /* Sets the accessed bit to ACCESSED in the PTE for virtual page
- VPAGE in PD. */
+ VPAGE in PD.  A 4 MB page has one accessed bit for all of its
+ pages. */
 void pagedir_set_accessed(uint32_t *pd, const void *vpage, bool accessed)
 {
-	uint32_t *pte = lookup_page(pd, vpage, false);
+	uint32_t *pte = lookup_large(pd, vpage);
+	if (pte == NULL)
+		pte = lookup_page(pd, vpage, false);
 	if (pte != NULL)
 	{
 		if (accessed)
 			*pte |= PTE_A;
 		else
 		{
-			*pte &= ~(uint32_t) PTE_A;
-			invalidate_pagedir(pd);
+			if (*pte & PTE_P)
+				*pte &= ~(uint32_t) PTE_REF;
+			if (*pte & PTE_A)
+			{
+				*pte &= ~(uint32_t) PTE_A;
+				invalidate_page(pd, vpage);
+			}
+		}
+	}
+}
+
+/* Sets the writable bit to WRITABLE in the PTE for the present
+ virtual page VPAGE in PD. */
+void pagedir_set_writable(uint32_t *pd, const void *vpage, bool writable)
+{
+	uint32_t *pte = lookup_page(pd, vpage, false);
+	if (pte != NULL && (*pte & PTE_P) != 0)
+	{
+		if (writable)
+			*pte |= PTE_W;
+		else
+			*pte &= ~(uint32_t) PTE_W;
+		invalidate_page(pd, vpage);
+	}
+}
+
+/* Counts the present user pages of PD that have been accessed
+ since the last call and clears their accessed bits, for
+ working-set estimates.  A 4 MB page counts as all of its
+ pages.  The bits are kept in PTE_REF for page replacement. */
+size_t pagedir_sample_accessed(uint32_t *pd)
+{
+	uint32_t *pde, *pte;
+	size_t cnt = 0;
+
+	for (pde = pd; pde < pd + pd_no(PHYS_BASE); pde++)
+	{
+		if ((*pde & PTE_P) == 0)
+			continue;
+		if (*pde & PTE_PS)
+		{
+			if (*pde & PTE_A)
+			{
+				*pde = (*pde & ~(uint32_t) PTE_A) | PTE_REF;
+				cnt += 1 << PTBITS;
+			}
+			continue;
 		}
+		for (pte = pde_get_pt(*pde); pte < pde_get_pt(*pde) + (1 << PTBITS);
+				pte++)
+			if ((*pte & (PTE_P | PTE_A)) == (PTE_P | PTE_A))
+			{
+				*pte = (*pte & ~(uint32_t) PTE_A) | PTE_REF;
+				cnt++;
+			}
 	}
+
+	//too many pages to invalidate one by one
+	if (cnt > 0)
+		invalidate_pagedir(pd);
+	return cnt;
 }
 
 /* Loads page directory PD into the CPU's page directory base
@@ -280,7 +433,74 @@ static void invalidate_pagedir(uint32_t *pd)
 		/* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
 		 "Translation Lookaside Buffers (TLBs)". */
 		pagedir_activate(pd);
+		tlb_flush_cnt++;
+	}
+}
+
+/* Invalidates the TLB entry for virtual page VPAGE if PD is the
+ active page directory.  Inside a batch the invalidation is
+ deferred to pagedir_batch_end(). */
+static void invalidate_page(uint32_t *pd, const void *vpage)
+{
+	struct thread *t;
+
+	if (active_pd() != pd)
+		return;
+
+	t = thread_current();
+	if (t->tlb_batch > 0)
+	{
+		if (t->tlb_pending < TLB_BATCH_PAGES)
+			t->tlb_pages[t->tlb_pending] = (void *) vpage;
+		t->tlb_pending++;
+	}
+	else
+	{
+		asm volatile ("invlpg (%0)" : : "r" (vpage) : "memory");
+		tlb_page_cnt++;
+	}
+}
+
+/* Starts a batch of page table changes, such as an munmap or an
+ eviction scan, whose TLB invalidations are deferred until the
+ matching pagedir_batch_end().  Batches nest.  The caller must
+ not touch the affected pages through the active page
+ directory before the batch ends. */
+void pagedir_batch_begin(void)
+{
+	thread_current()->tlb_batch++;
+}
+
+/* Ends a batch started by pagedir_batch_begin().  At the end of
+ the outermost batch, a few deferred pages are invalidated one
+ by one, more by a single flush of the whole TLB. */
+void pagedir_batch_end(void)
+{
+	struct thread *t = thread_current();
+	int i;
+
+	ASSERT(t->tlb_batch > 0);
+	if (--t->tlb_batch > 0 || t->tlb_pending == 0)
+		return;
+
+	if (t->tlb_pending > TLB_BATCH_PAGES)
+		invalidate_pagedir(active_pd());
+	else
+	{
+		for (i = 0; i < t->tlb_pending; i++)
+			asm volatile ("invlpg (%0)" : : "r" (t->tlb_pages[i]) : "memory");
+		tlb_page_cnt += t->tlb_pending;
 	}
+	t->tlb_pending = 0;
+}
+
+/* Prints TLB invalidation statistics. */
+void pagedir_print_stats(void)
+{
+	printf("TLB: %lld full flushes, %lld single-page invalidations\n",
+			tlb_flush_cnt, tlb_page_cnt);
+	printf("Large pages: %lld mapped, %lld split\n", large_map_cnt,
+			large_split_cnt);
 }
 
 #ifdef VM
@@ -291,20 +511,27 @@ void *pagedir_op_page(uint32_t *pd, void *uaddr, void *vm_page)
 	//perform find operation
 	if (vm_page == NULL)
 	{
+		entry = lookup_large(pd, uaddr);
+		if (entry != NULL)
+			return VM_frame_page(
+					ptov(*entry & PDMASK) + pt_no(uaddr) * PGSIZE, pd,
+					pg_round_down(uaddr));
 		entry = lookup_page(pd, uaddr, false);
 		if (entry != NULL)
 		{
 			if ((*entry & PTE_P) != 0)
 			{
-				void *kpage = pte_get_page(*entry) + pg_ofs(uaddr);
-				void *addr = VM_get_frame(kpage, pd, PAL_USER);
+				void *kpage = pte_get_page(*entry);
+				void *addr = VM_frame_page(kpage, pd, pg_round_down(uaddr));
 				return addr;
 			}
 			else
 			{
 				if (*entry == 0)
 					return NULL;
-				return *entry;
+				if (*entry & PTE_COMPACT)
+					return VM_expand_page(pd, pg_round_down(uaddr), entry);
+				return (void *) *entry;
 			}
 		}
 		return NULL;
@@ -326,4 +553,31 @@ void *pagedir_op_page(uint32_t *pd, void *uaddr, void *vm_page)
 	}
 	return NULL;
 }
+
+/* Returns the page table entry of user page UPAGE in PD, after
+ splitting a 4 MB page that covers it, or a null pointer if PD
+ has no page table for UPAGE or the split fails. */
+uint32_t *
+pagedir_lookup(uint32_t *pd, const void *upage)
+{
+	return lookup_page(pd, upage, false);
+}
+
+/* Returns the page table entry of user page UPAGE in PD as it
+ is, or 0 if PD has no page table for UPAGE.  For a 4 MB page
+ this is its PDE.  Unlike pagedir_op_page(), neither expands a
+ compact entry nor splits a 4 MB page, so it allocates nothing;
+ callers test PTE_P and PTE_COMPACT on the result. */
+uint32_t
+pagedir_peek(uint32_t *pd, const void *upage)
+{
+	uint32_t *pde = lookup_large(pd, upage);
+
+	if (pde != NULL)
+		return *pde;
+	pde = pd + pd_no(upage);
+	if (*pde == 0)
+		return 0;
+	return pde_get_pt(*pde)[pt_no(upage)];
+}
 #endif
@@ -4,22 +4,32 @@
 #ifdef VM
 #include "vm/struct.h"
 #endif
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 uint32_t *pagedir_create(void);
 void pagedir_destroy(uint32_t *pd);
 bool pagedir_set_page(uint32_t *pd, void *upage, void *kpage, bool rw);
+bool pagedir_set_large(uint32_t *pd, void *upage, void *kpage, bool rw);
+bool pagedir_split(uint32_t *pd, const void *upage);
 void *pagedir_get_page(uint32_t *pd, const void *upage);
 void pagedir_clear_page(uint32_t *pd, void *upage);
 bool pagedir_is_dirty(uint32_t *pd, const void *upage);
 void pagedir_set_dirty(uint32_t *pd, const void *upage, bool dirty);
 bool pagedir_is_accessed(uint32_t *pd, const void *upage);
 void pagedir_set_accessed(uint32_t *pd, const void *upage, bool accessed);
+void pagedir_set_writable(uint32_t *pd, const void *upage, bool writable);
+size_t pagedir_sample_accessed(uint32_t *pd);
 void pagedir_activate(uint32_t *pd);
+void pagedir_batch_begin(void);
+void pagedir_batch_end(void);
+void pagedir_print_stats(void);
 
 #ifdef VM
 void *pagedir_op_page(uint32_t *pd, void *uaddr, void *vm_page);
+uint32_t *pagedir_lookup(uint32_t *pd, const void *upage);
+uint32_t pagedir_peek(uint32_t *pd, const void *upage);
 #endif
 
 #endif /* userprog/pagedir.h */
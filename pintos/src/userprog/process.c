@@ -27,6 +27,19 @@
 
 static thread_func start_process NO_RETURN;
 static bool load(const char *cmdline, void (**eip)(void), void **esp);
+#ifdef VM
+static thread_func start_fork NO_RETURN;
+static bool fork_files(struct thread *parent);
+
+//handed by process_fork() to the child's start_fork()
+struct fork_struct
+{
+	struct thread *parent;
+	struct intr_frame frame; //the parent's frame of the fork system call
+	struct semaphore done; //upped by the child once it is a copy, or failed
+	bool success; //the child is a copy, set before DONE is upped
+};
+#endif
 
 /* Starts a new thread running a user program loaded from
  FILENAME.  The new thread may be scheduled (and may even exit)
@@ -102,6 +115,9 @@ static void start_process(void *file_name_)
 	if_.eflags = FLAG_IF | FLAG_MBS;
 
 	argument = strtok_r(file_name, " ", &saveptr);
+#ifdef VM
+	thread_current()->rss_limit = vm_rss_limit;
+#endif
 	success = load(argument, &if_.eip, &if_.esp);
 
 	current_thread = thread_current();
@@ -173,7 +189,9 @@ static void start_process(void *file_name_)
 
 	if_.esp = sp;
 
+#ifndef VM
 	current_thread->exec = filesys_open(file_name);
+#endif
 
 	//MINE MINE MINE!!!
 	file_deny_write(current_thread->exec);
@@ -198,6 +216,127 @@ static void start_process(void *file_name_)
 	;
 }
 
+#ifdef VM
+/* Starts a copy of the current process that resumes from the
+ system call frame F with a return value of 0.  Returns the
+ child's thread id, or TID_ERROR if it could not be created. */
+tid_t process_fork(struct intr_frame *f)
+{
+	struct fork_struct fork;
+	tid_t tid;
+
+	fork.parent = thread_current();
+	fork.frame = *f;
+	sema_init(&fork.done, 0);
+	fork.success = false;
+	tid = thread_create(thread_current()->name, PRI_DEFAULT, start_fork, &fork);
+	if (tid == TID_ERROR)
+		return tid;
+
+	//wait for the child to copy us. A child that failed is gone by then.
+	sema_down(&fork.done);
+
+	return fork.success ? tid : TID_ERROR;
+}
+
+/* A thread function that copies the address space and open files
+ of the forking process and returns to user mode. */
+static void start_fork(void *fork_)
+{
+	struct fork_struct *fork = fork_;
+	struct thread *parent = fork->parent;
+	struct thread *current_thread = thread_current();
+	struct intr_frame if_ = fork->frame;
+	bool success = false;
+
+	current_thread->rss_limit = parent->rss_limit;
+	current_thread->heap_start = parent->heap_start;
+	current_thread->brk = parent->brk;
+	current_thread->pagedir = pagedir_create();
+	if (current_thread->pagedir != NULL)
+	{
+		process_activate();
+		success = fork_files(parent) && VM_fork(parent);
+	}
+
+	if (!success)
+	{
+		enum intr_level old_level;
+
+		//the parent gets TID_ERROR and never waits for us, so we leave its
+		//children rather than wait in process_exit() to be reaped
+		old_level = intr_disable();
+		list_remove(&current_thread->child_elem);
+		current_thread->parent = NULL;
+		intr_set_level(old_level);
+		current_thread->return_status = RET_STATUS_ERROR;	//Error
+
+		//mapped files the parent shares with us go back to the parent alone
+		while (!list_empty(&current_thread->mmap_files))
+			system_call_munmap(
+					list_entry(list_front(&current_thread->mmap_files),
+							struct mmap_struct, thread_mmap_list)->mapid);
+		sema_up(&fork->done);	//unblock process_fork
+		thread_exit();
+	}
+
+	if_.eax = 0;
+	fork->success = true;
+	sema_up(&fork->done); //unblock process_fork
+
+	asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+	NOT_REACHED ()
+	;
+}
+
+//gives the current process the executable and the open files of PARENT,
+//under the same descriptors and at the same positions
+static bool fork_files(struct thread *parent)
+{
+	struct thread *cur = thread_current();
+	struct list_elem *e;
+	bool success = true;
+
+	lock_acquire(&file_lock);
+	cur->exec = file_reopen(parent->exec);
+	if (cur->exec == NULL)
+		success = false;
+	else
+		file_deny_write(cur->exec);
+
+	for (e = list_begin(&parent->files);
+			e != list_end(&parent->files) && success; e = list_next(e))
+	{
+		struct file_struct *pf = list_entry(e, struct file_struct,
+				thread_file_elem);
+		struct file_struct *cf = (struct file_struct *) malloc(
+				sizeof(struct file_struct));
+		if (cf == NULL)
+		{
+			success = false;
+			break;
+		}
+
+		cf->fid = pf->fid;
+		cf->f = NULL;
+		cf->d = NULL;
+		if (pf->d != NULL)
+			cf->d = dir_reopen(pf->d);
+		else
+		{
+			cf->f = file_reopen(pf->f);
+			if (cf->f != NULL)
+				file_seek(cf->f, file_tell(pf->f));
+		}
+		list_push_back(&cur->files, &cf->thread_file_elem);
+		if (cf->f == NULL && cf->d == NULL)
+			success = false;
+	}
+	lock_release(&file_lock);
+	return success;
+}
+#endif
+
 /* Waits for thread TID to die and returns its exit status.  If
  it was terminated by the kernel (i.e. killed due to an
  exception), returns -1.  If TID is invalid or if it was not a
@@ -246,9 +385,11 @@ void process_exit(void)
 	struct thread *cur = thread_current();
 	uint32_t *pd;
 
+#ifndef VM
 	if (cur->exec != NULL)
 		//I am bored of cur->exec. You may have it now
 		file_allow_write(cur->exec);
+#endif
 
 	while (!list_empty(&cur->sema_process_wait.waiters))
 		sema_up(&cur->sema_process_wait);
@@ -274,10 +415,21 @@ void process_exit(void)
 		 directory before destroying the process's page
 		 directory, or our active page directory will be one
 		 that's been freed (and cleared). */
+#ifdef VM
+		VM_prefetch_cancel(cur);
+		exception_save_process(cur);
+#endif
 		cur->pagedir = NULL;
 		pagedir_activate(NULL);
 		pagedir_destroy(pd);
 	}
+#ifdef VM
+	//dirty data pages went to swap above instead of into the executable,
+	//only now may others write it again
+	file_close(cur->exec);
+	cur->exec = NULL;
+	VM_vma_destroy();
+#endif
 }
 
 /* Sets up the CPU for running user code in the current
@@ -472,6 +624,15 @@ bool load(const char *file_name, void (**eip)(void), void **esp)
 
 	done:
 	/* We arrive here whether the load is successful or not. */
+#ifdef VM
+	//pages of the executable are loaded lazily from FILE, so it stays open
+	//as the process's executable
+	if (success)
+	{
+		t->exec = file;
+		file = NULL;
+	}
+#endif
 	file_close(file);
 	return success;
 }
@@ -584,40 +745,15 @@ static bool load_segment(struct file *file, off_t ofs, uint8_t *upage,
 	}
 	return true;
 #else
-	struct page_struct *p = NULL;
-	off_t load_offset = ofs;
-	off_t bid = -1;	//block ID
-	struct inode *inode = NULL;
-	while (read_bytes > 0 || zero_bytes > 0)
-	{
-		/* Calculate how to fill this page.
-		 We will read PAGE_READ_BYTES bytes from FILE
-		 and zero the final PAGE_ZERO_BYTES bytes. */
-		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-		size_t page_zero_bytes = PGSIZE - page_read_bytes;
+	struct thread *t = thread_current();
 
-		bid = -1;
-		if (!writable)
-		{
-			inode = file_get_inode(file);
-			if (inode != NULL)
-			bid = byte_to_sector(inode, load_offset);
-		}
-		p = NULL;
-		p = VM_new_page(TYPE_FILE, upage, writable, file, load_offset,
-				page_read_bytes, page_zero_bytes, bid);
-		if (p != NULL)
-		{
-			read_bytes -= page_read_bytes;
-			zero_bytes -= page_zero_bytes;
-			upage += PGSIZE;
-			load_offset = load_offset + PGSIZE;
-		}
-		else
-		return false;
-	}
-	file_seek(file, ofs);
-	return true;
+	//the heap starts right above the highest segment
+	if ((void *) upage + read_bytes + zero_bytes > t->heap_start)
+		t->heap_start = t->brk = upage + read_bytes + zero_bytes;
+
+	//the pages are created from the region when first touched
+	return VM_vma_add(upage, upage + read_bytes + zero_bytes, TYPE_FILE,
+			writable, file, ofs, read_bytes) != NULL;
 #endif
 }
 
@@ -644,8 +780,12 @@ static bool setup_stack(void **esp)
 #else
 	struct page_struct *p;
 	p = NULL;
-	p = VM_new_page(TYPE_ZERO, ((uint8_t *) PHYS_BASE) - PGSIZE, true, NULL,
-			NULL, NULL, NULL, NULL);
+	//the stack region grows down from its first page, up to STACK_SIZE
+	if (VM_vma_add(PHYS_BASE - PGSIZE, PHYS_BASE, TYPE_STACK, true, NULL, 0, 0)
+			== NULL)
+		return false;
+	p = VM_new_page(TYPE_ZERO, ((uint8_t *) PHYS_BASE) - PGSIZE, true, NULL, 0,
+			0, 0, 0);
 	if (p != NULL)
 	{
 		*esp = PHYS_BASE;
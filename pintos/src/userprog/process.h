@@ -7,6 +7,10 @@ tid_t process_execute(const char *file_name);
 int process_wait(tid_t);
 void process_exit(void);
 void process_activate(void);
+#ifdef VM
+struct intr_frame;
+tid_t process_fork(struct intr_frame *f);
+#endif
 
 #define RET_STATUS_ERROR -1
 #define RET_STATUS_OK 0
@@ -5,6 +5,9 @@
 #include "threads/thread.h"
 
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 static void syscall_handler(struct intr_frame *);
 
@@ -26,6 +29,9 @@ static void syscall_handler(struct intr_frame *f)
 	int *argument = f->esp;
 	int ret_val = 0;
 
+#ifdef VM
+	VM_compact_pages();
+#endif
 	if (is_user_vaddr(call_number))
 	{
 		//printf("Call Number: %d\n", *call_number);
@@ -158,6 +164,38 @@ static void syscall_handler(struct intr_frame *f)
 			else
 				system_call_exit(-1);
 			break;
+#endif
+#ifdef VM
+		case SYS_FORK:
+			ret_val = system_call_fork(f);
+			break;
+		case SYS_MSYNC:
+			if (is_user_vaddr(argument + 1))
+				system_call_msync(*(argument + 1));
+			else
+				system_call_exit(-1);
+			break;
+		case SYS_MADVISE:
+			if (is_user_vaddr(argument + 1) && is_user_vaddr(argument + 2)
+					&& is_user_vaddr(argument + 3))
+				ret_val = system_call_madvise((void *) *(argument + 1),
+						*(argument + 2), *(argument + 3));
+			else
+				system_call_exit(-1);
+			break;
+		case SYS_MMAP_ANON:
+			if (is_user_vaddr(argument + 1) && is_user_vaddr(argument + 2))
+				ret_val = system_call_mmap_anon((void *) *(argument + 1),
+						*(argument + 2));
+			else
+				system_call_exit(-1);
+			break;
+		case SYS_SBRK:
+			if (is_user_vaddr(argument + 1))
+				ret_val = (int) system_call_sbrk(*(argument + 1));
+			else
+				system_call_exit(-1);
+			break;
 #endif
 		default:
 			system_call_exit(-1);
@@ -41,6 +41,15 @@ bool system_call_isdir(int fd);//callNumber: 18
 int system_call_inumber(int fd);//callNumber: 19
 #endif
 
+#ifdef VM
+struct intr_frame;
+pid_t system_call_fork(struct intr_frame *f);//CallNumber: 20
+void system_call_msync(mapid_t mapid);//CallNumber: 21
+bool system_call_madvise(void *addr, unsigned size, int advice);//CallNumber: 22
+mapid_t system_call_mmap_anon(void *addr, unsigned length);//CallNumber: 23
+void *system_call_sbrk(intptr_t increment);//CallNumber: 24
+#endif
+
 struct file_struct *fd_to_file(int fid);
 
 #endif /* userprog/syscall.h */
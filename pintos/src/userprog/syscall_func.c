@@ -7,6 +7,7 @@
 #include "threads/malloc.h"
 #include "devices/input.h"
 #include <stdio.h>
+#include <round.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
@@ -23,6 +24,8 @@ static int new_fid = 2;
 
 #ifdef VM
 static int new_mapid = 2;
+
+static struct mmap_struct *mapid_to_mmap(mapid_t mapid);
 #endif
 
 void system_call_halt(void)
@@ -47,6 +50,7 @@ void system_call_exit(int status)
 	}
 
 #ifdef VM
+	pagedir_batch_begin();
 	while (true)
 	{
 		if (list_empty(&t->mmap_files))
@@ -55,6 +59,7 @@ void system_call_exit(int status)
 		system_call_munmap(
 				list_entry (e, struct mmap_struct, thread_mmap_list)->mapid);
 	}
+	pagedir_batch_end();
 #endif
 
 	t->return_status = status;
@@ -79,6 +84,13 @@ int system_call_wait(pid_t pid)
 	return process_wait(pid);
 }
 
+#ifdef VM
+pid_t system_call_fork(struct intr_frame *f)
+{
+	return process_fork(f);
+}
+#endif
+
 bool system_call_create(const char *file, unsigned initial_size)
 {
 	if (file != NULL)
@@ -191,18 +203,24 @@ int system_call_filesize(int fd)
 	return size;
 }
 
+#ifdef VM
+//bytes of the user buffer at BUFFER, of SIZE bytes, that a read or write
+//pins and copies at once
+static size_t pin_chunk(const void *buffer, size_t size)
+{
+	size_t chunk = PIN_CHUNK_PAGES * PGSIZE - pg_ofs(buffer);
+	return size < chunk ? size : chunk;
+}
+#endif
+
 int system_call_read(int fd, void *buffer, unsigned size)
 {
 	int ret_val = -1;
 	unsigned int offset = 0;
 	struct file_struct *f = NULL;
 #ifdef VM
-	size_t remaining = 0;
-	size_t bytes_read = 0;
-	size_t left = 0;
-	void *address = NULL;
-	void *temp_buffer = (void *) buffer;
-	ret_val = 0;
+	size_t chunk = 0;
+	int bytes_read = 0;
 	const void *esp = (const void*) param_esp;
 #endif
 
@@ -229,42 +247,25 @@ int system_call_read(int fd, void *buffer, unsigned size)
 		lock_release(&file_lock);
 		return ret_val;
 #else
-		for (remaining = size; remaining > 0;
-				remaining = remaining - bytes_read)
+		//a fault on the buffer while holding file_lock could deadlock
+		//eviction, so each chunk is made resident and pinned first
+		ret_val = 0;
+		for (offset = 0; offset < size; offset += chunk)
 		{
-			bool stack_status = ((uint32_t) temp_buffer > 0)
-			&& (temp_buffer >= (esp - 32))
-			&& ((PHYS_BASE - pg_round_down(temp_buffer)) <= (1 << 23));
-
-			offset = temp_buffer - pg_round_down(temp_buffer);
-			address = temp_buffer - offset;
-			struct page_struct *page = VM_find_page(address);
-
-			if (page == NULL)
-			if (stack_status)
-			page = VM_stack_grow(temp_buffer - offset, true);
-			else
-			system_call_exit(-1);
-
-			//load the page and pin it
-			if (!page->loaded)
-			VM_operation_page(OP_LOAD, page, page->physical_address, true);
-
-			left = offset + remaining;
-			if (left > PGSIZE)
-			bytes_read = remaining - left + PGSIZE;
-			else
-			bytes_read = remaining;
+			chunk = pin_chunk(buffer + offset, size - offset);
+			if (!VM_pin_range(buffer + offset, chunk, true, esp))
+				system_call_exit(-1);
 
 			lock_acquire(&file_lock);
-			ret_val = ret_val + file_read(f->f, temp_buffer, bytes_read);
+			bytes_read = file_read(f->f, buffer + offset, chunk);
 			lock_release(&file_lock);
 
-			temp_buffer = temp_buffer + bytes_read;
-			VM_pin(false, page->physical_address, true);
+			VM_unpin_range(buffer + offset, chunk);
+			ret_val += bytes_read;
+			if ((size_t) bytes_read < chunk)
+				break;
 		}
 		return ret_val;
-
 #endif
 	}
 }
@@ -273,6 +274,12 @@ int system_call_write(int fd, const void *buffer, unsigned size)
 {
 	int ret_val = -1;
 	struct file_struct *f = NULL;
+#ifdef VM
+	unsigned int offset = 0;
+	size_t chunk = 0;
+	int bytes_written = 0;
+	const void *esp = (const void*) param_esp;
+#endif
 
 	if (!is_user_vaddr(buffer) || !is_user_vaddr(buffer + size))
 		system_call_exit(-1);
@@ -289,10 +296,30 @@ int system_call_write(int fd, const void *buffer, unsigned size)
 		lock_release(&file_lock);
 		if (f == NULL || f->d != NULL)
 			return -1;
+#ifndef VM
 		lock_acquire(&file_lock);
 		ret_val = file_write(f->f, buffer, size);
 		lock_release(&file_lock);
 		return ret_val;
+#else
+		ret_val = 0;
+		for (offset = 0; offset < size; offset += chunk)
+		{
+			chunk = pin_chunk(buffer + offset, size - offset);
+			if (!VM_pin_range(buffer + offset, chunk, false, esp))
+				system_call_exit(-1);
+
+			lock_acquire(&file_lock);
+			bytes_written = file_write(f->f, buffer + offset, chunk);
+			lock_release(&file_lock);
+
+			VM_unpin_range(buffer + offset, chunk);
+			ret_val += bytes_written;
+			if ((size_t) bytes_written < chunk)
+				break;
+		}
+		return ret_val;
+#endif
 	}
 }
 
@@ -374,14 +401,66 @@ fd_to_file(int fid)
 }
 
 #ifdef VM
+//records the mapping of [START, END), of FILE or anonymous if FILE is NULL,
+//which already has its region, and returns its new mapid. If out of memory,
+//removes the region, closes FILE and returns -1.
+static mapid_t mmap_register(int fd, struct file *file, void *start,
+		void *end)
+{
+	mapid_t mapid;
+	struct mmap_file *mfile = NULL;
+
+	struct mmap_struct *mf = (struct mmap_struct *) malloc(
+			sizeof(struct mmap_struct));
+	if (mf != NULL && file != NULL)
+	{
+		mfile = (struct mmap_file *) malloc(sizeof(struct mmap_file));
+		if (mfile == NULL)
+		{
+			free(mf);
+			mf = NULL;
+		}
+	}
+	if (mf == NULL)
+	{
+		VM_vma_remove(VM_vma_find(start));
+		if (file != NULL)
+		{
+			lock_acquire(&file_lock);
+			file_close(file);
+			lock_release(&file_lock);
+		}
+		return -1;
+	}
+
+	mapid = new_mapid++;
+	lock_acquire(&l[LOCK_MMAP]);
+	mf->fid = fd;
+	mf->mapid = mapid;
+	mf->tid = thread_current()->tid;
+	mf->mfile = mfile;
+	if (mfile != NULL)
+	{
+		mfile->file = file;
+		mfile->user_cnt = 1;
+	}
+	mf->start_address = start;
+	mf->end_address = end;
+
+	//Insert file to hashmap
+	list_push_front(&thread_current()->mmap_files, &mf->thread_mmap_list);
+	hash_insert(&hash_mmap, &mf->frame_hash_elem);
+
+	lock_release(&l[LOCK_MMAP]);
+	return mapid;
+}
+
 mapid_t system_call_mmap(int fd, void *address)
 {
 	ASSERT(fd != STDIN_FILENO || fd != STDOUT_FILENO);
 
 	size_t size;
 	struct file *f = NULL;
-	size_t start_bytes;
-	size_t first_bytes;
 
 	size = system_call_filesize(fd);
 	lock_acquire(&file_lock);
@@ -400,103 +479,94 @@ mapid_t system_call_mmap(int fd, void *address)
 			|| pg_ofs(address) != 0)
 	return -1;
 
-	size_t offset = 0;
-	void *tmp_addr = address;
-
-	while (size > 0)
+	//one region for the whole file, its pages are created on first touch
+	void *end_address = address + ROUND_UP(size, PGSIZE);
+	if (end_address > PHYS_BASE || end_address < address
+			|| VM_vma_add(address, end_address, TYPE_FILE, true, f, 0, size)
+					== NULL)
 	{
-		if (size < PGSIZE)
-		{
-			start_bytes = size;
-			first_bytes = PGSIZE - size;
-		}
-		else
-		{
-			start_bytes = PGSIZE;
-			first_bytes = 0;
-		}
+		lock_acquire(&file_lock);
+		file_close(f);
+		lock_release(&file_lock);
+		return -1;
+	}
 
-		//If a page is already mapped, fail
-		struct page_struct * temp = VM_find_page(tmp_addr);
-		if (temp == NULL)
-		{
+	return mmap_register(fd, f, address, end_address);
+}
 
-			temp = VM_new_page(TYPE_FILE, tmp_addr, true, f, offset,
-					start_bytes, first_bytes, -1);
+//maps LENGTH bytes of zeros at ADDRESS. The pages are made on first touch
+//and go to swap when evicted, they are private to a forked child.
+mapid_t system_call_mmap_anon(void *address, unsigned length)
+{
+	void *end_address = address + ROUND_UP(length, PGSIZE);
 
-			if (temp != NULL)
-			{
-				offset += PGSIZE;
-				size -= start_bytes;
-				tmp_addr += PGSIZE;
-			}
-			else
-			return -1;
-		}
-		else
+	if (length == 0 || address == NULL || pg_ofs(address) != 0
+			|| end_address > PHYS_BASE || end_address < address
+			|| VM_vma_add(address, end_address, TYPE_ZERO, true, NULL, 0, 0)
+					== NULL)
 		return -1;
-	}
-
-	mapid_t mapid = new_mapid++;
+	return mmap_register(-1, NULL, address, end_address);
+}
 
-	struct mmap_struct *mf = (struct mmap_struct *) malloc(
-			sizeof(struct mmap_struct));
-	if (mf != NULL)
-	{
-		lock_acquire(&l[LOCK_MMAP]);
-		mf->fid = fd;
-		mf->mapid = mapid;
-		mf->start_address = address;
-		mf->end_address = tmp_addr;
-
-		//Insert file to hashmap
-		list_push_front(&thread_current()->mmap_files, &mf->thread_mmap_list);
-		hash_insert(&hash_mmap, &mf->frame_hash_elem);
-
-		lock_release(&l[LOCK_MMAP]);
-		return mapid;
-	}
-	else
-	return NULL;
+//moves the break of the current process by INCREMENT bytes, and returns the
+//previous break, or (void *) -1
+void *system_call_sbrk(intptr_t increment)
+{
+	return VM_sbrk(increment);
 }
 
-void system_call_munmap(mapid_t mapid)
+//returns the mapping MAPID of the current process, or NULL
+static struct mmap_struct *mapid_to_mmap(mapid_t mapid)
 {
 	struct mmap_struct mm_temp;
-	struct mmap_struct *mf = NULL;
 	struct hash_elem *e = NULL;
-	struct page_struct *page = NULL;
 
 	mm_temp.mapid = mapid;
+	mm_temp.tid = thread_current()->tid;
+	lock_acquire(&l[LOCK_MMAP]);
 	e = hash_find(&hash_mmap, &mm_temp.frame_hash_elem);
-	if (e != NULL)
-	{
-		mf = hash_entry(e, struct mmap_struct, frame_hash_elem);
-	}
+	lock_release(&l[LOCK_MMAP]);
+	if (e == NULL)
+		return NULL;
+	return hash_entry(e, struct mmap_struct, frame_hash_elem);
+}
+
+void system_call_msync(mapid_t mapid)
+{
+	struct mmap_struct *mf = mapid_to_mmap(mapid);
+
+	if (mf == NULL)
+		system_call_exit(-1);
+	VM_mmap_sync(mf);
+}
+
+bool system_call_madvise(void *addr, unsigned size, int advice)
+{
+	return VM_madvise(addr, size, advice);
+}
+
+void system_call_munmap(mapid_t mapid)
+{
+	struct mmap_struct *mf = mapid_to_mmap(mapid);
+	struct vma_struct *vma;
+	bool last;
+
 	if (mf != NULL)
 	{
-		void *end_addr = mf->end_address;
-		void *cur_addr = mf->start_address;
-		// Given a file, free each page mapped in memory
-		while (cur_addr < end_addr)
-		{
-			page = VM_find_page(cur_addr);
-			if (page != NULL)
-			{
-				if (page->loaded)
-				{
-					VM_pin(true, page, false);
-
-					if (page->loaded && page->physical_address != NULL)
-					VM_free_frame(page->physical_address, page->pagedir);
-					else
-					PANIC("Problem in system unmap");
-				}
-				VM_operation_page(OP_FREE, page, NULL, NULL);
-				cur_addr += PGSIZE;
-				page = NULL;
-			}
-		}
+		//prefetches may still read from the file that is closed below
+		VM_prefetch_cancel(thread_current());
+
+		//dirty pages are written back together, so unloading finds them
+		//clean. While forked processes still map the file, the frames they
+		//share are left for the last of them to write.
+		if (mf->mfile != NULL && mf->mfile->user_cnt == 1)
+			VM_mmap_sync(mf);
+
+		VM_unmap_range(mf->start_address, mf->end_address);
+		//a fork that failed may not have got to the region
+		vma = VM_vma_find(mf->start_address);
+		if (vma != NULL)
+			VM_vma_remove(vma);
 	}
 	else
 	system_call_exit(-1);
@@ -505,8 +575,17 @@ void system_call_munmap(mapid_t mapid)
 	lock_acquire(&l[LOCK_MMAP]);
 	hash_delete(&hash_mmap, &mf->frame_hash_elem);
 	list_remove(&mf->thread_mmap_list);
-	free(mf);
+	last = mf->mfile != NULL && --mf->mfile->user_cnt == 0;
 	lock_release(&l[LOCK_MMAP]);
+
+	if (last)
+	{
+		lock_acquire(&file_lock);
+		file_close(mf->mfile->file);
+		lock_release(&file_lock);
+		free(mf->mfile);
+	}
+	free(mf);
 }
 #endif
 
@@ -0,0 +1,31 @@
+#!/bin/bash
+#runs the paging tests under each replacement policy and reports the page
+#faults, evictions and swap traffic of each run
+POLICIES="clock aging wsclock 2q"
+TESTS="page-merge-seq page-merge-par page-merge-stk page-merge-mm page-shuffle
+mmap-read mmap-write mmap-shuffle mmap-msync mmap-advise"
+
+echo "building"
+make
+status=$?;
+if [ $status -eq 0 ]
+then
+	cd build
+	for policy in $POLICIES
+	do
+		echo "== $policy"
+		START=$SECONDS
+		for test in $TESTS
+		do
+			rm -f tests/vm/$test.output tests/vm/$test.result
+			make -s tests/vm/$test.result KERNELFLAGS=-evict=$policy \
+				> /dev/null 2>&1
+			echo "$test: `head -n 1 tests/vm/$test.result`"
+			grep -h -e "Exception: .* page faults" -e "frames evicted" \
+				-e "swapped out" tests/vm/$test.output | sed 's/^/	/'
+		done
+		END=$SECONDS
+		TIME=`expr $END - $START`
+		echo "$policy took "$TIME "seconds"
+	done
+fi
@@ -1,11 +1,72 @@
 #include "vm/struct.h"
+#include "devices/timer.h"
+
+//timer ticks between two samples of the accessed bits for the policies
+//that keep a history of them
+#define SAMPLE_TICKS 4
+
+//wsclock: ticks a frame may go unused and still be in the working set
+#define WS_TAU (TIMER_FREQ / 2)
+
+//2q: recently evicted pages remembered
+#define GHOST_MAX 256
+
+//a page replacement policy, chosen with -evict. Its functions are called
+//with the eviction lock held, and all but free with the frame lock too.
+struct evict_policy
+{
+	const char *name;
+	//the frame VF was given to PAGE, may be NULL
+	void (*load)(struct frame_struct *vf, struct page_struct *page);
+	//periodic sample of whether VF was accessed, may be NULL
+	void (*sample)(struct frame_struct *vf, bool accessed);
+	//returns the frame to evict, NULL if all are pinned
+	struct frame_struct *(*victim)(void);
+	//VF, still holding its pages, is about to be evicted, may be NULL
+	void (*free)(struct frame_struct *vf);
+};
+
+static struct frame_struct *frame_register(void *address);
+static bool evict_local(struct thread *t);
+static void evict_sampler(void *aux);
+static bool frame_accessed(struct frame_struct *vf);
+static struct frame_struct *clock_victim(void);
+static void aging_load(struct frame_struct *vf, struct page_struct *page);
+static void aging_sample(struct frame_struct *vf, bool accessed);
+static struct frame_struct *aging_victim(void);
+static void wsclock_load(struct frame_struct *vf, struct page_struct *page);
+static void wsclock_sample(struct frame_struct *vf, bool accessed);
+static struct frame_struct *wsclock_victim(void);
+static void twoq_load(struct frame_struct *vf, struct page_struct *page);
+static void twoq_sample(struct frame_struct *vf, bool accessed);
+static struct frame_struct *twoq_victim(void);
+static void twoq_free(struct frame_struct *vf);
+
+static const struct evict_policy policies[] =
+{
+{ "clock", NULL, NULL, clock_victim, NULL },
+{ "aging", aging_load, aging_sample, aging_victim, NULL },
+{ "wsclock", wsclock_load, wsclock_sample, wsclock_victim, NULL },
+{ "2q", twoq_load, twoq_sample, twoq_victim, twoq_free } };
+static const struct evict_policy *policy = &policies[0];
+
+//2q: the last GHOST_MAX pages evicted, as a ring
+static struct
+{
+	uint32_t *pagedir;
+	void *upage;
+} ghosts[GHOST_MAX];
+static size_t ghost_next;
+
+static long long local_evict_cnt; //pages a process over its limit evicted
+static long long evict_cnt; //frames evicted by the replacement policy
+static long long sample_cnt; //samples of the accessed bits taken
 
 void *VM_get_frame(void *frame, uint32_t *pagedir, enum palloc_flags flags)
 {
 	//decide based on parameters
 	if (frame == NULL)
 	{
-		struct frame_struct *vf = NULL;
 		void *address = palloc_get_page(flags);
 
 		//if allocation was unsuccessful
@@ -16,47 +77,92 @@ void *VM_get_frame(void *frame, uint32_t *pagedir, enum palloc_flags flags)
 		}
 
 		//otherwise, proceed
-		vf = (struct frame_struct *) malloc(sizeof(struct frame_struct));
-		if (vf != NULL)
-		{
-			vf->physical_address = address;
-			vf->persistent = true;
-			list_init(&vf->shared_pages);
-			lock_init(&vf->page_list_lock);
-
-			lock_acquire(&l[LOCK_FRAME]);
-			list_push_front(&hash_frame_list, &vf->frame_list_elem);
-			hash_insert(&hash_frame, &vf->hash_elem);
-			lock_release(&l[LOCK_FRAME]);
-		}
+		frame_register(address);
 		return address;
 	}
 	else
+		return VM_frame_page(frame, pagedir, NULL);
+
+}
+
+//adds the frame at ADDRESS to the frame table, pinned
+static struct frame_struct *frame_register(void *address)
+{
+	struct frame_struct *vf = NULL;
+
+	vf = (struct frame_struct *) malloc(sizeof(struct frame_struct));
+	if (vf != NULL)
 	{
-		struct frame_struct *vf = NULL;
-		struct page_struct *page = NULL;
-		struct list_elem *elem;
+		vf->physical_address = address;
+		vf->persistent = true;
+		vf->share_bid = -1;
+		vf->age = 0;
+		vf->last_use = timer_ticks();
+		vf->hot = false;
+		vf->ksm_pass = 0;
+		list_init(&vf->shared_pages);
+		lock_init(&vf->page_list_lock);
 
-		vf = address_to_frame(frame);
-		if (vf != NULL)
+		lock_acquire(&l[LOCK_FRAME]);
+		list_push_front(&hash_frame_list, &vf->frame_list_elem);
+		hash_insert(&hash_frame, &vf->hash_elem);
+		lock_release(&l[LOCK_FRAME]);
+	}
+	return vf;
+}
+
+//gets LARGE_PAGES zeroed frames that are physically contiguous and aligned
+//for a 4 MB page. Each is a frame of its own, pinned, so that the large page
+//can later be split and evicted page by page. Returns NULL if the user pool
+//has no such block free, this never evicts.
+void *VM_get_large_frame(void)
+{
+	uint8_t *address = palloc_get_aligned(PAL_USER | PAL_ZERO, LARGE_PAGES);
+	size_t i;
+
+	if (address == NULL)
+		return NULL;
+	for (i = 0; i < LARGE_PAGES; i++)
+		if (frame_register(address + i * PGSIZE) == NULL)
 		{
-			lock_acquire(&vf->page_list_lock);
-			elem = list_begin(&vf->shared_pages);
-			while (elem != list_end(&vf->shared_pages))
+			palloc_free_multiple(address + i * PGSIZE, LARGE_PAGES - i);
+			while (i-- > 0)
+				VM_free_frame(address + i * PGSIZE, NULL);
+			return NULL;
+		}
+	return address;
+}
+
+//returns the page of PAGEDIR that shares FRAME, or NULL. If UPAGE is not
+//NULL the page must also be mapped at UPAGE, as a frame like the zero frame
+//may back several pages of one process.
+struct page_struct *VM_frame_page(void *frame, uint32_t *pagedir,
+		const void *upage)
+{
+	struct frame_struct *vf = NULL;
+	struct page_struct *page = NULL;
+	struct list_elem *elem;
+
+	vf = address_to_frame(frame);
+	if (vf != NULL)
+	{
+		lock_acquire(&vf->page_list_lock);
+		elem = list_begin(&vf->shared_pages);
+		while (elem != list_end(&vf->shared_pages))
+		{
+			page = list_entry(elem, struct page_struct, frame_elem);
+			if (page->pagedir != pagedir
+					|| (upage != NULL && page->virtual_address != upage))
 			{
-				page = list_entry(elem, struct page_struct, frame_elem);
-				if (page->pagedir != pagedir)
-				{
-					elem = list_next(elem);
-					continue;
-				}
-				break;
+				page = NULL;
+				elem = list_next(elem);
+				continue;
 			}
-			lock_release(&vf->page_list_lock);
+			break;
 		}
-		return page;
+		lock_release(&vf->page_list_lock);
 	}
-
+	return page;
 }
 
 //frees frame and writes data to swap
@@ -76,8 +182,11 @@ void VM_free_frame(void *address, uint32_t *pagedir)
 
 	if (pagedir == NULL)
 	{
+		bool written = false;
 
 		lock_acquire(&vf->page_list_lock);
+		if (policy->free != NULL)
+			policy->free(vf);
 		while (true)
 		{
 			if (list_empty(&vf->shared_pages))
@@ -85,6 +194,34 @@ void VM_free_frame(void *address, uint32_t *pagedir)
 			e = list_begin(&vf->shared_pages);
 			page = list_entry(e, struct page_struct, frame_elem);
 			list_remove(&page->frame_elem);
+
+			//processes that share a frame of a mapped file write it once
+			if (page->type == TYPE_FILE && !file_check_write(page->file))
+			{
+				if (written)
+					pagedir_set_dirty(page->pagedir, page->virtual_address,
+							false);
+				else
+					written = pagedir_is_dirty(page->pagedir,
+							page->virtual_address);
+			}
+			VM_operation_page(OP_UNLOAD, page, vf->physical_address, false);
+			VM_compact_note(page);
+		}
+		lock_release(&vf->page_list_lock);
+	}
+	else if (address == zero_frame)
+	{
+		//the zero frame backs many pages of a process, drop all of PAGEDIR's
+		lock_acquire(&vf->page_list_lock);
+		e = list_begin(&vf->shared_pages);
+		while (e != list_end(&vf->shared_pages))
+		{
+			page = list_entry(e, struct page_struct, frame_elem);
+			e = list_next(e);
+			if (page->pagedir != pagedir)
+				continue;
+			list_remove(&page->frame_elem);
 			VM_operation_page(OP_UNLOAD, page, vf->physical_address, false);
 		}
 		lock_release(&vf->page_list_lock);
@@ -94,21 +231,31 @@ void VM_free_frame(void *address, uint32_t *pagedir)
 
 		page = VM_get_frame(address, pagedir, PAL_USER);
 
-		if (page != NULL)
+		//the page may have been evicted already, and the frame reused
+		if (page == NULL)
 		{
-			lock_acquire(&vf->page_list_lock);
-			list_remove(&page->frame_elem);
-			lock_release(&vf->page_list_lock);
-			VM_operation_page(OP_UNLOAD, page, vf->physical_address, false);
+			lock_release(&l[LOCK_EVICT]);
+			return;
 		}
+		lock_acquire(&vf->page_list_lock);
+		list_remove(&page->frame_elem);
+		lock_release(&vf->page_list_lock);
+		VM_operation_page(OP_UNLOAD, page, vf->physical_address, false);
 	}
 
-	if (!list_empty(&vf->shared_pages))
+	if (!list_empty(&vf->shared_pages) || address == zero_frame)
 	{
 		lock_release(&l[LOCK_EVICT]);
 		return;
 	}
 
+	if (vf->share_bid != -1)
+	{
+		lock_acquire(&l[LOCK_SHARE]);
+		hash_delete(&hash_share, &vf->share_elem);
+		lock_release(&l[LOCK_SHARE]);
+	}
+
 	lock_acquire(&l[LOCK_FRAME]);
 	hash_delete(&hash_frame, &vf->hash_elem);
 	list_remove(&vf->frame_list_elem);
@@ -138,38 +285,395 @@ bool eviction_clock(struct frame_struct *f)
 	return true;
 }
 
+//evicts a frame chosen by the replacement policy, and writes its pages out
 void evict()
 {
+	struct frame_struct *victim;
+	void *kpage;
+
+	//the scan clears accessed bits one page at a time
+	pagedir_batch_begin();
+	lock_acquire(&l[LOCK_EVICT]);
+	lock_acquire(&l[LOCK_FRAME]);
+
+	//all frames may be pinned for a moment
+	while ((victim = policy->victim()) == NULL)
+	{
+		lock_release(&l[LOCK_FRAME]);
+		lock_release(&l[LOCK_EVICT]);
+		thread_yield();
+		lock_acquire(&l[LOCK_EVICT]);
+		lock_acquire(&l[LOCK_FRAME]);
+	}
+	kpage = victim->physical_address;
+	evict_cnt++;
+
+	lock_release(&l[LOCK_FRAME]);
+	lock_release(&l[LOCK_EVICT]);
+	thread_current()->fault_flags |= 1 << FAULT_EVICT;
+	VM_free_frame(kpage, NULL);
+	pagedir_batch_end();
+}
+
+//tells the replacement policy that PAGE was just given the frame VF
+void VM_frame_loaded(struct frame_struct *vf, struct page_struct *page)
+{
+	if (policy->load == NULL)
+		return;
 	lock_acquire(&l[LOCK_EVICT]);
 	lock_acquire(&l[LOCK_FRAME]);
-	struct frame_struct *frame_to_evict = NULL;
-	struct list_elem *e = list_end(&hash_frame_list);
-	struct frame_struct *cur_frame = list_entry(e, struct frame_struct,
-			frame_list_elem);
+	policy->load(vf, page);
+	lock_release(&l[LOCK_FRAME]);
+	lock_release(&l[LOCK_EVICT]);
+}
 
-	while (true)
+//picks the replacement policy named by -evict, and starts the sampler if
+//the policy uses one. Panics on an unknown name.
+void VM_evict_init(void)
+{
+	size_t i;
+
+	if (vm_evict_name != NULL)
 	{
-		//printf("stuck in while loop");
-		cur_frame = list_entry(e, struct frame_struct, frame_list_elem);
-		if (cur_frame == NULL)
-			PANIC("Something wrong with eviction");
+		policy = NULL;
+		for (i = 0; i < sizeof policies / sizeof *policies; i++)
+			if (!strcmp(policies[i].name, vm_evict_name))
+				policy = &policies[i];
+		if (policy == NULL)
+			PANIC("unknown replacement policy `%s'", vm_evict_name);
+	}
+	if (policy->sample != NULL)
+		thread_create("evict-sample", PRI_MAX, evict_sampler, NULL);
+}
+
+//every SAMPLE_TICKS, hands each frame and whether any of its pages was
+//accessed since the last sample to the policy, and clears the bits
+static void evict_sampler(void *aux UNUSED)
+{
+	struct list_elem *e, *next;
 
-		if (cur_frame->persistent == true || !eviction_clock(cur_frame))
+	for (;;)
+	{
+		timer_sleep(SAMPLE_TICKS);
+		lock_acquire(&l[LOCK_EVICT]);
+		lock_acquire(&l[LOCK_FRAME]);
+		//a frame the policy moves to the front is not seen twice
+		for (e = list_begin(&hash_frame_list); e != list_end(&hash_frame_list);
+				e = next)
 		{
-			if (e == NULL || e == list_begin(&hash_frame_list))
-				e = list_end(&hash_frame_list);
-			else
-				e = list_prev(e);
+			struct frame_struct *vf = list_entry(e, struct frame_struct,
+					frame_list_elem);
+			next = list_next(e);
+			policy->sample(vf, frame_accessed(vf));
+		}
+		lock_release(&l[LOCK_FRAME]);
+		lock_release(&l[LOCK_EVICT]);
+		sample_cnt++;
+	}
+}
+
+//returns true if a page of VF was accessed, and clears the accessed bits of
+//all its pages
+static bool frame_accessed(struct frame_struct *vf)
+{
+	struct list_elem *e;
+	bool accessed = false;
+
+	lock_acquire(&vf->page_list_lock);
+	for (e = list_begin(&vf->shared_pages); e != list_end(&vf->shared_pages);
+			e = list_next(e))
+	{
+		struct page_struct *page = list_entry(e, struct page_struct,
+				frame_elem);
+		if (pagedir_is_accessed(page->pagedir, page->virtual_address))
+		{
+			pagedir_set_accessed(page->pagedir, page->virtual_address, false);
+			accessed = true;
+		}
+	}
+	lock_release(&vf->page_list_lock);
+	return accessed;
+}
+
+//returns true if a page of VF is dirty, so that evicting VF writes it out
+static bool frame_dirty(struct frame_struct *vf)
+{
+	struct list_elem *e;
+	bool dirty = false;
+
+	lock_acquire(&vf->page_list_lock);
+	for (e = list_begin(&vf->shared_pages);
+			!dirty && e != list_end(&vf->shared_pages); e = list_next(e))
+	{
+		struct page_struct *page = list_entry(e, struct page_struct,
+				frame_elem);
+		dirty = pagedir_is_dirty(page->pagedir, page->virtual_address);
+	}
+	lock_release(&vf->page_list_lock);
+	return dirty;
+}
+
+//moves the oldest frame to the front of the frame list, like a clock hand
+//passing it, and returns it
+static struct frame_struct *frame_rotate(void)
+{
+	struct list_elem *e = list_pop_back(&hash_frame_list);
+
+	list_push_front(&hash_frame_list, e);
+	return list_entry(e, struct frame_struct, frame_list_elem);
+}
+
+//clock: second chance. The hand goes from the oldest frame on, clearing
+//the accessed bit of a page of each frame it passes; the first frame found
+//without one is evicted.
+static struct frame_struct *clock_victim(void)
+{
+	size_t n = 2 * list_size(&hash_frame_list);
+
+	while (n-- > 0)
+	{
+		struct frame_struct *vf = frame_rotate();
+		if (!vf->persistent && eviction_clock(vf))
+			return vf;
+	}
+	return NULL;
+}
+
+//aging: each sample shifts the frame's counter right, with the accessed
+//bit on top; the frame with the lowest counter is the least recently used
+static void aging_load(struct frame_struct *vf,
+		struct page_struct *page UNUSED)
+{
+	vf->age = 0x80;
+}
+
+static void aging_sample(struct frame_struct *vf, bool accessed)
+{
+	vf->age = (vf->age >> 1) | (accessed ? 0x80 : 0);
+}
+
+static struct frame_struct *aging_victim(void)
+{
+	struct frame_struct *victim = NULL;
+	struct list_elem *e;
+
+	//the oldest frame wins a tie
+	for (e = list_rbegin(&hash_frame_list); e != list_rend(&hash_frame_list);
+			e = list_prev(e))
+	{
+		struct frame_struct *vf = list_entry(e, struct frame_struct,
+				frame_list_elem);
+		if (!vf->persistent && (victim == NULL || vf->age < victim->age))
+			victim = vf;
+	}
+	return victim;
+}
+
+//wsclock: a clock that only evicts frames out of the working set, not
+//used for WS_TAU ticks, and prefers clean ones. There is no write-behind, so
+//an old dirty frame is taken when no old clean one is found in a turn.
+static void wsclock_load(struct frame_struct *vf,
+		struct page_struct *page UNUSED)
+{
+	vf->last_use = timer_ticks();
+}
+
+static void wsclock_sample(struct frame_struct *vf, bool accessed)
+{
+	if (accessed)
+		vf->last_use = timer_ticks();
+}
+
+static struct frame_struct *wsclock_victim(void)
+{
+	struct frame_struct *old_dirty = NULL, *unused = NULL;
+	int64_t now = timer_ticks();
+	size_t n = list_size(&hash_frame_list);
+
+	while (n-- > 0)
+	{
+		struct frame_struct *vf = frame_rotate();
+		if (vf->persistent)
+			continue;
+		if (!eviction_clock(vf))
+		{
+			vf->last_use = now;
 			continue;
 		}
+		if (now - vf->last_use <= WS_TAU)
+		{
+			if (unused == NULL)
+				unused = vf;
+			continue;
+		}
+		if (!frame_dirty(vf))
+			return vf;
+		if (old_dirty == NULL)
+			old_dirty = vf;
+	}
+	if (old_dirty != NULL)
+		return old_dirty;
+	return unused != NULL ? unused : clock_victim();
+}
+
+//2q: frames enter a FIFO queue and are only promoted to the main queue, an
+//LRU list, when a later sample finds them accessed again, or when their page
+//was evicted a short while ago. The FIFO queue is evicted first once it
+//holds more than a quarter of the frames, so a scan cannot flush the main
+//queue. The age of a frame counts the samples it has seen in the FIFO queue.
+static void twoq_load(struct frame_struct *vf, struct page_struct *page)
+{
+	size_t i;
 
-		frame_to_evict = cur_frame;
-		break;
+	vf->hot = false;
+	vf->age = 0;
+	for (i = 0; i < GHOST_MAX; i++)
+		if (ghosts[i].pagedir == page->pagedir
+				&& ghosts[i].upage == page->virtual_address)
+		{
+			ghosts[i].pagedir = NULL;
+			vf->hot = true;
+			break;
+		}
+}
+
+static void twoq_sample(struct frame_struct *vf, bool accessed)
+{
+	if (!vf->hot)
+	{
+		//the access of the load itself does not count
+		if (accessed && vf->age > 0)
+			vf->hot = true;
+		vf->age = 1;
+	}
+	if (accessed && vf->hot)
+	{
+		list_remove(&vf->frame_list_elem);
+		list_push_front(&hash_frame_list, &vf->frame_list_elem);
+	}
+}
+
+static struct frame_struct *twoq_victim(void)
+{
+	struct frame_struct *fifo = NULL, *lru = NULL;
+	size_t fifo_cnt = 0, n = 0;
+	struct list_elem *e;
+
+	for (e = list_rbegin(&hash_frame_list); e != list_rend(&hash_frame_list);
+			e = list_prev(e))
+	{
+		struct frame_struct *vf = list_entry(e, struct frame_struct,
+				frame_list_elem);
+		n++;
+		if (vf->persistent)
+			continue;
+		if (!vf->hot)
+		{
+			fifo_cnt++;
+			if (fifo == NULL)
+				fifo = vf;
+		}
+		else if (lru == NULL && eviction_clock(vf))
+			lru = vf;
+	}
+	if (fifo != NULL && (fifo_cnt > n / 4 || lru == NULL))
+		return fifo;
+	return lru != NULL ? lru : clock_victim();
+}
+
+//remembers the pages of the evicted frame VF, whose page list is locked, so
+//that they go straight to the main queue when they come back
+static void twoq_free(struct frame_struct *vf)
+{
+	struct list_elem *e;
+
+	for (e = list_begin(&vf->shared_pages); e != list_end(&vf->shared_pages);
+			e = list_next(e))
+	{
+		struct page_struct *page = list_entry(e, struct page_struct,
+				frame_elem);
+		ghosts[ghost_next].pagedir = page->pagedir;
+		ghosts[ghost_next].upage = page->virtual_address;
+		ghost_next = (ghost_next + 1) % GHOST_MAX;
 	}
+}
+
+//local replacement: while T maps at least its limit of frames, evicts its
+//own pages, so that a process over its limit does not take frames from
+//the others.
+void VM_evict_local(struct thread *t)
+{
+	if (t->rss_limit <= 0)
+		return;
+
+	pagedir_batch_begin();
+	while (t->rss >= t->rss_limit && evict_local(t))
+	{
+		t->fault_flags |= 1 << FAULT_EVICT;
+		local_evict_cnt++;
+	}
+	pagedir_batch_end();
+}
+
+//evicts one page of T that is not accessed, with a clock over the frame
+//table that clears the accessed bits of T's pages as it goes. Returns false
+//if T has no page that can be evicted.
+static bool evict_local(struct thread *t)
+{
+	struct frame_struct *victim = NULL;
+	struct list_elem *e, *pe;
+	void *kpage = NULL;
+	int pass;
+
+	lock_acquire(&l[LOCK_EVICT]);
+	lock_acquire(&l[LOCK_FRAME]);
+	for (pass = 0; pass < 2 && victim == NULL; pass++)
+		for (e = list_rbegin(&hash_frame_list);
+				e != list_rend(&hash_frame_list) && victim == NULL;
+				e = list_prev(e))
+		{
+			struct frame_struct *vf = list_entry(e, struct frame_struct,
+					frame_list_elem);
+			struct page_struct *page = NULL;
 
+			if (vf->persistent)
+				continue;
+			lock_acquire(&vf->page_list_lock);
+			for (pe = list_begin(&vf->shared_pages);
+					pe != list_end(&vf->shared_pages); pe = list_next(pe))
+			{
+				page = list_entry(pe, struct page_struct, frame_elem);
+				if (page->owner == t)
+					break;
+				page = NULL;
+			}
+			lock_release(&vf->page_list_lock);
+			if (page == NULL)
+				continue;
+
+			if (pagedir_is_accessed(t->pagedir, page->virtual_address))
+				pagedir_set_accessed(t->pagedir, page->virtual_address, false);
+			else
+				victim = vf;
+		}
+	if (victim != NULL)
+		kpage = victim->physical_address;
 	lock_release(&l[LOCK_FRAME]);
 	lock_release(&l[LOCK_EVICT]);
-	VM_free_frame(frame_to_evict->physical_address, NULL);
+
+	if (kpage == NULL)
+		return false;
+	VM_free_frame(kpage, t->pagedir);
+	return true;
+}
+
+//prints statistics of frame replacement
+void VM_print_frame_stats(void)
+{
+	printf("VM: %s replacement, %lld frames evicted, %lld samples\n",
+			policy->name, evict_cnt, sample_cnt);
+	printf("VM: %lld pages evicted by processes over their -rss limit\n",
+			local_evict_cnt);
 }
 
 struct frame_struct *address_to_frame(void *address)
@@ -7,9 +7,18 @@
 void VM_free_frame(void *address, uint32_t *pagedir);
 
 void *VM_get_frame(void *frame, uint32_t *pagedir, enum palloc_flags flags);
+void *VM_get_large_frame(void);
 
 struct frame_struct *address_to_frame(void *address);
+struct page_struct *VM_frame_page(void *frame, uint32_t *pagedir,
+		const void *upage);
 
+struct thread;
 void evict(void);
+void VM_evict_init(void);
+struct page_struct;
+void VM_frame_loaded(struct frame_struct *vf, struct page_struct *page);
+void VM_evict_local(struct thread *t);
+void VM_print_frame_stats(void);
 bool eviction_clock(struct frame_struct *vf);
 #endif
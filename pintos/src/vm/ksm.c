@@ -0,0 +1,168 @@
+#include "vm/struct.h"
+#include "devices/timer.h"
+
+//the merging thread wakes up every KSM_TICKS, and scans the frames it is
+//given in chunks of KSM_CHUNK, collected under one hold of the frame lock
+#define KSM_TICKS (TIMER_FREQ / 10)
+#define KSM_CHUNK 32
+
+//a frame seen during the current pass, by the checksum of its data
+struct ksm_node
+{
+	unsigned checksum; //hash_bytes() of the frame
+	void *kpage; //the frame, which may have changed or been freed since
+	struct hash_elem elem;
+};
+
+static struct hash ksm_table; //frames seen during the current pass
+static unsigned ksm_pass = 1; //stamps the frames looked at this pass
+static unsigned zero_checksum; //checksum of a page of zeros
+
+static long long ksm_scan_cnt; //frames scanned
+static long long ksm_pass_cnt; //complete passes over the frame table
+static long long ksm_merge_cnt; //pages merged into another process's frame
+static long long ksm_zero_cnt; //pages of zeros merged into the zero frame
+
+static void ksm_thread(void *aux);
+static size_t ksm_collect(void **kpages, size_t cnt);
+static void ksm_scan(void *kpage);
+static unsigned ksm_hash(const struct hash_elem *e, void *aux);
+static bool ksm_less(const struct hash_elem *a, const struct hash_elem *b,
+		void *aux);
+static void ksm_free(struct hash_elem *e, void *aux);
+
+//starts the merging thread if -ksm asked for it
+void VM_ksm_init(void)
+{
+	if (vm_ksm_rate <= 0)
+		return;
+	hash_init(&ksm_table, ksm_hash, ksm_less, NULL);
+	zero_checksum = hash_bytes(zero_frame, PGSIZE);
+	thread_create("ksm", PRI_DEFAULT, ksm_thread, NULL);
+}
+
+//scans vm_ksm_rate frames a second. Pages of zeros go to the zero frame,
+//other pages to an earlier frame of the pass with the same data.
+static void ksm_thread(void *aux UNUSED)
+{
+	void *kpages[KSM_CHUNK];
+	size_t budget, cnt, i;
+
+	for (;;)
+	{
+		timer_sleep(KSM_TICKS);
+		budget = vm_ksm_rate * KSM_TICKS / TIMER_FREQ;
+		if (budget == 0)
+			budget = 1;
+		while (budget > 0)
+		{
+			cnt = ksm_collect(kpages, budget < KSM_CHUNK ? budget : KSM_CHUNK);
+			for (i = 0; i < cnt; i++)
+				ksm_scan(kpages[i]);
+			budget -= cnt;
+			if (cnt == 0)
+				break;
+		}
+	}
+}
+
+//stores in KPAGES up to CNT frames that may be merged, among those not
+//looked at yet this pass. Frames are stamped with the pass rather than
+//counted by position, as eviction reorders the frame table. Once every frame
+//has been looked at a new pass starts, which forgets the frames of the last
+//one. Returns the number stored.
+static size_t ksm_collect(void **kpages, size_t cnt)
+{
+	struct list_elem *e;
+	size_t found = 0;
+	bool pass_done;
+
+	lock_acquire(&l[LOCK_FRAME]);
+	for (e = list_begin(&hash_frame_list);
+			e != list_end(&hash_frame_list) && found < cnt; e = list_next(e))
+	{
+		struct frame_struct *vf = list_entry(e, struct frame_struct,
+				frame_list_elem);
+		if (vf->ksm_pass == ksm_pass)
+			continue;
+		vf->ksm_pass = ksm_pass;
+		if (!vf->persistent && vf->share_bid == -1
+				&& vf->physical_address != zero_frame)
+			kpages[found++] = vf->physical_address;
+	}
+	pass_done = e == list_end(&hash_frame_list);
+	if (pass_done)
+		ksm_pass++;
+	lock_release(&l[LOCK_FRAME]);
+
+	if (pass_done)
+	{
+		hash_clear(&ksm_table, ksm_free);
+		ksm_pass_cnt++;
+	}
+	return found;
+}
+
+//merges KPAGE with a frame of the same data seen earlier in the pass, or
+//remembers it for later frames
+static void ksm_scan(void *kpage)
+{
+	struct ksm_node key, *node;
+	struct hash_elem *e;
+
+	ksm_scan_cnt++;
+	key.checksum = hash_bytes(kpage, PGSIZE);
+	if (key.checksum == zero_checksum && VM_merge(kpage, NULL))
+	{
+		ksm_zero_cnt++;
+		return;
+	}
+
+	e = hash_find(&ksm_table, &key.elem);
+	if (e != NULL)
+	{
+		node = hash_entry(e, struct ksm_node, elem);
+		if (node->kpage == kpage)
+			return;
+		if (VM_merge(kpage, node->kpage))
+		{
+			ksm_merge_cnt++;
+			return;
+		}
+		//the earlier frame changed or went away, this one replaces it
+		node->kpage = kpage;
+		return;
+	}
+
+	node = (struct ksm_node *) malloc(sizeof(struct ksm_node));
+	if (node == NULL)
+		return;
+	node->checksum = key.checksum;
+	node->kpage = kpage;
+	hash_insert(&ksm_table, &node->elem);
+}
+
+//prints statistics of page merging
+void VM_print_ksm_stats(void)
+{
+	printf("VM: %lld frames scanned for merging in %lld passes, "
+			"%lld pages merged, %lld into the zero frame\n", ksm_scan_cnt,
+			ksm_pass_cnt, ksm_merge_cnt + ksm_zero_cnt, ksm_zero_cnt);
+}
+
+static unsigned ksm_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+	return hash_entry(e, struct ksm_node, elem)->checksum;
+}
+
+static bool ksm_less(const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED)
+{
+	return hash_entry(a, struct ksm_node, elem)->checksum
+			< hash_entry(b, struct ksm_node, elem)->checksum;
+}
+
+static void ksm_free(struct hash_elem *e, void *aux UNUSED)
+{
+	free(hash_entry(e, struct ksm_node, elem));
+}
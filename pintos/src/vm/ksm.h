@@ -0,0 +1,9 @@
+#ifndef VM_KSM_H
+#define VM_KSM_H
+
+#include "vm/struct.h"
+
+void VM_ksm_init(void);
+void VM_print_ksm_stats(void);
+
+#endif
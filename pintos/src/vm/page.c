@@ -1,4 +1,60 @@
 #include "vm/struct.h"
+#include "filesys/inode.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "devices/timer.h"
+#include <round.h>
+
+//fault-around: a file fault also maps up to the current thread's
+//fault_window following pages of the same segment or mapping. The window
+//doubles on sequential faults and halves on random ones.
+#define FAULT_AROUND_MAX 16
+
+static long long file_fault_cnt; //file faults handled by fault-around
+static long long fault_around_cnt; //extra pages mapped by fault-around
+static long long share_cnt; //text pages mapped to another process's frame
+static long long fork_share_cnt; //resident pages a fork shared with its parent
+static long long cow_copy_cnt; //copy-on-write faults that copied a frame
+static long long zero_map_cnt; //read faults that mapped the zero frame
+static long long zero_copy_cnt; //zero frame mappings later written to
+static long long zero_drop_cnt; //all-zero pages dropped instead of swapped
+static long long large_fault_cnt; //write faults that mapped a whole 4 MB page
+static int rss_peak; //largest resident set of any process
+static int wss_peak; //largest working-set sample of any process
+static long long wss_sample_cnt; //working-set samples taken
+static long long sync_page_cnt; //dirty mmap pages written back in batches
+static long long sync_batch_cnt; //batches, one file_lock acquisition each
+static long long sync_clean_cnt; //resident mmap pages found clean
+static long long drop_behind_cnt; //pages unloaded behind sequential scans
+static long long dontneed_cnt; //pages dropped by MADV_DONTNEED
+static long long pin_range_cnt; //user buffers pinned for read and write
+static long long pin_page_cnt; //pages of those buffers
+static long long teardown_page_cnt; //pages freed by batched teardowns
+static long long teardown_frame_cnt; //frames they gave back to the pool
+static long long teardown_slot_cnt; //swap slots they released
+static long long teardown_write_cnt; //dirty mapped file pages they wrote
+static long long teardown_batch_cnt; //batches, one lock acquisition each
+static long long compact_cnt; //page_structs replaced by compact entries
+static long long expand_cnt; //compact entries given a page_struct again
+static long long teardown_compact_cnt; //compact entries freed by teardowns
+static long long swap_out_cnt; //pages written to swap
+static long long swap_in_cnt; //pages read back from swap
+
+static bool page_get_frame(struct page_struct *page);
+static bool page_install(struct page_struct *page, bool accessed);
+static bool page_share(struct page_struct *page);
+static void page_publish(struct page_struct *page);
+static bool page_fork(struct thread *parent, void *upage, uint32_t pte);
+static struct mmap_struct *mmap_of(struct thread *t, void *upage);
+static uint32_t compact_encode(bool zero, size_t index, bool writable);
+static bool page_is_zero(const void *kpage);
+static void rss_add(struct thread *t, int cnt);
+static bool page_prefetched(struct page_struct *page);
+static void page_drop(struct page_struct *page);
+static void compact_drop(uint32_t *pd, void *upage, uint32_t pte);
+static void drop_behind(struct vma_struct *vma, uint8_t *upage);
+struct teardown;
+static void teardown_flush(struct teardown *td);
 
 // Initialise everything
 void VM_init(void)
@@ -10,10 +66,16 @@ void VM_init(void)
 	}
 	hash_init(&hash_frame, frame_hash, frame_less_helper, NULL);
 	hash_init(&hash_mmap, mmap_hash, mmap_less_helper, NULL);
+	hash_init(&hash_share, share_hash, share_less_helper, NULL);
 	list_init(&hash_frame_list);
-	swap_block = block_get_role(BLOCK_SWAP);
-	swap_size = block_size(swap_block);
-	swap_bitmap = bitmap_create(swap_size);
+	VM_swap_init();
+
+	//stays pinned, as it comes
+	zero_frame = VM_get_frame(NULL, NULL, PAL_USER | PAL_ZERO);
+
+	VM_evict_init();
+	VM_prefetch_init();
+	VM_ksm_init();
 }
 
 struct page_struct *VM_new_page(int type, void *virt_address, bool writable,
@@ -28,9 +90,11 @@ struct page_struct *VM_new_page(int type, void *virt_address, bool writable,
 		p->virtual_address = virt_address;
 		p->physical_address = NULL;
 		p->writable = writable;
+		p->cow = false;
 		p->loaded = false;
 		p->index = 0;
 		p->pagedir = thread_current()->pagedir;
+		p->owner = thread_current();
 	}
 	if (type == TYPE_ZERO)
 	{
@@ -75,7 +139,7 @@ bool VM_pin(bool operation, void *pagetemp, bool directFrameAccess)
 	if (page->physical_address == NULL || directFrameAccess)
 	{
 		struct frame_struct *f = address_to_frame(address);
-		if (f != NULL)
+		if (f != NULL && address != zero_frame)
 		{
 			switch (operation)
 			{
@@ -100,23 +164,30 @@ bool VM_operation_page(int operation, void *address, void * kpage, bool pinned)
 	//performs load operation
 	if (operation == OP_LOAD)
 	{
-		lock_acquire(&l[LOCK_LOAD]);
-
 		struct page_struct *page = (struct page_struct *) address;
 
-		//get empty frame
-		if (page->physical_address == NULL)
-			page->physical_address = VM_get_frame(NULL, NULL, PAL_USER);
+		//already read by the prefetch thread
+		if (page->type == TYPE_FILE && page_prefetched(page))
+		{
+			if (!pinned)
+				VM_pin(false, page->physical_address, true);
+			return true;
+		}
 
-		lock_release(&l[LOCK_LOAD]);
+		//text already loaded by another process
+		if (page_share(page))
+		{
+			thread_current()->fault_flags |= 1 << FAULT_SHARED;
+			if (pinned)
+				VM_pin(true, page->physical_address, true);
+			return true;
+		}
 
-		//creates mapping from page to frame
-		struct frame_struct *vf = address_to_frame(page->physical_address);
-		if (vf == NULL)
+		//get empty frame and map the page to it. A new frame for a zero page
+		//comes zeroed, from the pool the idle time fills.
+		bool fresh = page->physical_address == NULL;
+		if (!page_get_frame(page))
 			return false;
-		lock_acquire(&vf->page_list_lock);
-		list_push_back(&vf->shared_pages, &page->frame_elem);
-		lock_release(&vf->page_list_lock);
 
 		bool success = true;
 
@@ -141,44 +212,16 @@ bool VM_operation_page(int operation, void *address, void * kpage, bool pinned)
 			}
 		}
 		else if (page->type == TYPE_ZERO)
-			memset(page->physical_address, 0, PGSIZE);
+		{
+			if (!fresh)
+				memset(page->physical_address, 0, PGSIZE);
+		}
 		else
 		{
-			//Load a page to main memory from the swap area
-			size_t i = page->index;
-			void *address = page->physical_address;
-			size_t offset = 0;
-			int blocks_in_one_page = PGSIZE / BLOCK_SECTOR_SIZE;
-
-			lock_acquire(&l[LOCK_SWAP]);
-			while (offset < blocks_in_one_page)
-			{
-				if (bitmap_test(swap_bitmap, i) && i < swap_size)
-				{
-					void *buffer = address + offset * BLOCK_SECTOR_SIZE;
-					block_read(swap_block, i, buffer);
-				}
-				else
-					PANIC("Problem when loading a page from swap to main mem");
-
-				i++;
-				offset++;
-			}
-
-			//Free the swap frame
-			offset = 0;
-			i = page->index;
-			while (offset < blocks_in_one_page)
-			{
-				if (bitmap_test(swap_bitmap, i) && i < swap_size)
-					bitmap_reset(swap_bitmap, i);
-				else
-					PANIC("Problem when freeing swap -- OP_FREE");
-
-				i++;
-				offset++;
-			}
-			lock_release(&l[LOCK_SWAP]);
+			//Load a page to main memory from the swap area, and free its slot
+			VM_swap_read(page->index, page->physical_address);
+			VM_swap_free(page->index);
+			swap_in_cnt++;
 		}
 
 		if (!success)
@@ -187,20 +230,13 @@ bool VM_operation_page(int operation, void *address, void * kpage, bool pinned)
 			return false;
 		}
 
-		pagedir_clear_page(page->pagedir, page->virtual_address);
-		bool s = pagedir_set_page(page->pagedir, page->virtual_address,
-				page->physical_address, page->writable);
-		if (!s)
+		if (!page_install(page, true))
 		{
 			ASSERT(false);
 			VM_pin(false, page->physical_address, true);
 			return false;
 		}
 
-		pagedir_set_dirty(page->pagedir, page->virtual_address, false);
-		pagedir_set_accessed(page->pagedir, page->virtual_address, true);
-
-		page->loaded = true;
 		if (!pinned)
 			VM_pin(false, page->physical_address, true);
 		return true;
@@ -220,44 +256,30 @@ bool VM_operation_page(int operation, void *address, void * kpage, bool pinned)
 			file_write(page->file, kpage, page->read_bytes);
 			lock_release(&file_lock);
 			VM_pin(false, kpage, true);
+			thread_current()->fault_flags |= 1 << FAULT_WRITEBACK;
+		}
+		else if ((page->type == TYPE_SWAP
+				|| pagedir_is_dirty(page->pagedir, page->virtual_address))
+				&& page_is_zero(kpage))
+		{
+			//reads back as zeros without costing a swap slot
+			page->type = TYPE_ZERO;
+			zero_drop_cnt++;
 		}
 		else if (page->type == TYPE_SWAP
 				|| pagedir_is_dirty(page->pagedir, page->virtual_address))
 		{
 			//store the current page to swap
 			page->type = TYPE_SWAP;
+			thread_current()->fault_flags |= 1 << FAULT_WRITEBACK;
 
 			//move swap from main memory to swap
-			void * addr = kpage;
-			int blocks_in_one_page = PGSIZE / BLOCK_SECTOR_SIZE;
-			lock_acquire(&l[LOCK_SWAP]);
-			size_t index = bitmap_scan_and_flip(swap_bitmap, 0,
-					blocks_in_one_page,
-					false);
-
-			if (index != BITMAP_ERROR)
-			{
-				size_t offset = 0;
-				size_t i = index;
-				while (offset < blocks_in_one_page)
-				{
-					if (bitmap_test(swap_bitmap, i) && (index < swap_size))
-					{
-						block_write(swap_block, i,
-								addr + offset * BLOCK_SECTOR_SIZE);
-						i++;
-						offset++;
-					}
-					else
-						PANIC("Problem when moving a page from memory to swap");
-				}
-			}
-			else
-			{
+			size_t index = VM_swap_alloc();
+			if (index == BITMAP_ERROR)
 				PANIC(
 						"Problem when moving a page from memory to swap -- index");
-			}
-			lock_release(&l[LOCK_SWAP]);
+			VM_swap_write(index, kpage);
+			swap_out_cnt++;
 
 			page->index = index;
 		}
@@ -265,7 +287,10 @@ bool VM_operation_page(int operation, void *address, void * kpage, bool pinned)
 
 		pagedir_clear_page(page->pagedir, page->virtual_address);
 		pagedir_op_page(page->pagedir, page->virtual_address, (void *) page);
+		if (page->loaded && kpage != zero_frame)
+			rss_add(page->owner, -1);
 		page->loaded = false;
+		page->cow = false;
 		page->physical_address = NULL;
 	}
 	else if (operation == OP_FIND)
@@ -280,42 +305,810 @@ bool VM_operation_page(int operation, void *address, void * kpage, bool pinned)
 
 		//free swap data
 		if (page->type == TYPE_SWAP && !page->loaded)
+			VM_swap_free(page->index);
+
+		//clear mappings from thread's pagedir
+		pagedir_clear_page(page->pagedir, page->virtual_address);
+		free(page);
+		return true;
+	}
+	else
+	{
+		return false;
+	}
+	return false;
+}
+
+//loads the file page PAGE together with the run of non-resident pages that
+//follow it in the same file, reading all of them under a single acquisition
+//of file_lock. Neighbours are mapped with the accessed bit clear, so the
+//clock evicts them first if they turn out to be unused.
+bool VM_fault_around(struct page_struct *page)
+{
+	struct page_struct *batch[FAULT_AROUND_MAX + 1];
+	struct thread *t = thread_current();
+	struct vma_struct *vma = VM_vma_find(page->virtual_address);
+	int advice = vma != NULL ? vma->advice : MADV_NORMAL;
+	int cnt = 0, got = 0, i;
+
+	if (page_prefetched(page))
+	{
+		VM_pin(false, page->physical_address, true);
+		return true;
+	}
+
+	//the window follows the hint of the region, or else the faults seen
+	if (advice == MADV_SEQUENTIAL)
+		t->fault_window = FAULT_AROUND_MAX;
+	else if (advice == MADV_RANDOM)
+		t->fault_window = 0;
+	else if (page->virtual_address == t->fault_next)
+		t->fault_window = t->fault_window ? t->fault_window * 2 : 1;
+	else
+		t->fault_window /= 2;
+	if (t->fault_window > FAULT_AROUND_MAX)
+		t->fault_window = FAULT_AROUND_MAX;
+
+	//collect the contiguous run of file pages following PAGE. Text that
+	//another process already has in memory is mapped directly instead.
+	struct page_struct *prev = page;
+	int shared = page_share(page);
+	if (shared)
+		t->fault_flags |= 1 << FAULT_SHARED;
+	else
+		batch[cnt++] = page;
+	while (vma != NULL && cnt + shared <= t->fault_window)
+	{
+		uint8_t *next = prev->virtual_address + PGSIZE;
+		uint32_t pte;
+		struct page_struct *p;
+
+		//only the file data of the region, and without making page_structs
+		//for pages that are resident or held by compact entries
+		if (vma->type != TYPE_FILE || next >= (uint8_t *) vma->end_address
+				|| (size_t) (next - (uint8_t *) vma->start_address)
+						>= vma->read_bytes)
+			break;
+		pte = pagedir_peek(t->pagedir, next);
+		if ((pte & PTE_P) || (pte & PTE_COMPACT))
+			break;
+		p = VM_find_page(next);
+		if (p == NULL || p->loaded || p->type != TYPE_FILE
+				|| p->file != page->file
+				|| p->offset != prev->offset + PGSIZE)
+			break;
+		if (page_prefetched(p))
+		{
+			VM_pin(false, p->physical_address, true);
+			shared++;
+		}
+		else if (page_share(p))
+			shared++;
+		else
+			batch[cnt++] = p;
+		prev = p;
+	}
+	t->fault_next = prev->virtual_address + PGSIZE;
+	if (advice == MADV_SEQUENTIAL)
+		drop_behind(vma, page->virtual_address);
+	if (cnt == 0)
+		return true;
+
+	//frames come back pinned, so the batch cannot evict itself
+	for (i = 0; i < cnt; i++)
+		if (!page_get_frame(batch[i]))
+			break;
+	cnt = i;
+	if (cnt == 0)
+		return page->loaded;
+
+	lock_acquire(&file_lock);
+	for (got = 0; got < cnt; got++)
+	{
+		struct page_struct *p = batch[got];
+		if (file_read_at(p->file, p->physical_address, p->read_bytes,
+				p->offset) != (off_t) p->read_bytes)
+			break;
+	}
+	lock_release(&file_lock);
+
+	for (i = 0; i < cnt; i++)
+	{
+		struct page_struct *p = batch[i];
+		void *kpage = p->physical_address;
+
+		if (i < got)
+		{
+			memset(kpage + p->read_bytes, 0, p->zero_bytes);
+			if (page_install(p, p == page))
+			{
+				VM_pin(false, kpage, true);
+				continue;
+			}
+		}
+		VM_free_frame(kpage, p->pagedir);
+	}
+
+	file_fault_cnt++;
+	fault_around_cnt += got + shared - 1;
+	return page->loaded;
+}
+
+//gives the current process, forked from PARENT, a copy of PARENT's address
+//space. Resident private pages, anonymous mappings among them, are shared
+//copy-on-write and swapped out pages get a swap slot of their own. Mapped
+//files are inherited with the same file, and their resident frames are
+//shared writable, so that writes to them show in both processes.
+bool VM_fork(struct thread *parent)
+{
+	struct thread *cur = thread_current();
+	uint32_t *pd = parent->pagedir;
+	uint32_t *pde;
+	struct list_elem *e;
+	struct tree_elem *te;
+	bool success = true;
+
+	//mappings keep their ids, and mapped files are shared with the parent
+	for (e = list_begin(&parent->mmap_files); e != list_end(&parent->mmap_files);
+			e = list_next(e))
+	{
+		struct mmap_struct *pmf = list_entry(e, struct mmap_struct,
+				thread_mmap_list);
+		struct mmap_struct *mf = (struct mmap_struct *) malloc(
+				sizeof(struct mmap_struct));
+		if (mf == NULL)
+			return false;
+
+		mf->mfile = pmf->mfile;
+		mf->mapid = pmf->mapid;
+		mf->tid = cur->tid;
+		mf->fid = pmf->fid;
+		mf->start_address = pmf->start_address;
+		mf->end_address = pmf->end_address;
+
+		lock_acquire(&l[LOCK_MMAP]);
+		if (mf->mfile != NULL)
+			mf->mfile->user_cnt++;
+		list_push_back(&cur->mmap_files, &mf->thread_mmap_list);
+		hash_insert(&hash_mmap, &mf->frame_hash_elem);
+		lock_release(&l[LOCK_MMAP]);
+	}
+
+	//regions, with the executable switched over to the child's. Their pages
+	//that were never touched are left to be created on demand.
+	for (te = tree_first(&parent->vmas); te != NULL; te = tree_next(te))
+	{
+		struct vma_struct *vma = tree_entry(te, struct vma_struct, elem);
+		struct file *file = vma->file;
+
+		if (file != NULL && file == parent->exec)
+			file = cur->exec;
+		struct vma_struct *copy = VM_vma_add(vma->start_address,
+				vma->end_address, vma->type, vma->writable, file, vma->offset,
+				vma->read_bytes);
+		if (copy == NULL)
+			return false;
+		copy->advice = vma->advice;
+	}
+
+	//the parent waits for us, and no frame of it can be evicted meanwhile
+	lock_acquire(&l[LOCK_EVICT]);
+	for (pde = pd; pde < pd + pd_no(PHYS_BASE) && success; pde++)
+		if (*pde & PTE_P)
 		{
-			size_t offset = 0;
-			size_t i = page->index;
-			int blocks_in_one_page = PGSIZE / BLOCK_SECTOR_SIZE;
-			lock_acquire(&l[LOCK_SWAP]);
-			while (offset < blocks_in_one_page)
+			uint32_t *pt;
+			size_t i;
+
+			//copy-on-write works on single pages
+			if (!pagedir_split(pd, (void *) ((uintptr_t) (pde - pd) << PDSHIFT)))
 			{
+				success = false;
+				break;
+			}
+			pt = pde_get_pt(*pde);
+			for (i = 0; i < PGSIZE / sizeof *pt && success; i++)
+				if (pt[i] != 0)
+					success = page_fork(parent,
+							(void *) (((uintptr_t) (pde - pd) << PDSHIFT)
+									| (i << PTSHIFT)), pt[i]);
+		}
+	lock_release(&l[LOCK_EVICT]);
+	return success;
+}
 
-				if (bitmap_test(swap_bitmap, i) && i < swap_size)
-					bitmap_reset(swap_bitmap, i);
-				else
-					PANIC("Problem when freeing swap -- OP_FREE");
+//gives the resident page PAGE, which shares its frame copy-on-write, a
+//private writable frame. The last sharer of a frame just takes it over. If
+//PINNED, PAGE was pinned by the caller and its new frame stays pinned.
+bool VM_cow_break(struct page_struct *page, bool pinned)
+{
+	struct frame_struct *vf, *nf = NULL;
+	void *kpage = NULL;
+	bool copied = false;
 
-				i++;
-				offset++;
+	//a frame is only taken once a copy turns out to be needed. Getting it
+	//may evict, so the eviction lock is dropped meanwhile, and the check is
+	//made again after, as the other sharers may have gone.
+	lock_acquire(&l[LOCK_EVICT]);
+	while (page->loaded && page->cow)
+	{
+		bool shared;
+
+		vf = address_to_frame(page->physical_address);
+		lock_acquire(&vf->page_list_lock);
+		shared = list_size(&vf->shared_pages) > 1
+				|| vf->physical_address == zero_frame;
+		if (shared && kpage != NULL)
+		{
+			list_remove(&page->frame_elem);
+			copied = true;
+		}
+		lock_release(&vf->page_list_lock);
+		if (!shared || kpage != NULL)
+			break;
+
+		lock_release(&l[LOCK_EVICT]);
+		kpage = VM_get_frame(NULL, NULL, PAL_USER);
+		nf = address_to_frame(kpage);
+		if (nf == NULL)
+			return false;
+		lock_acquire(&l[LOCK_EVICT]);
+	}
+	if (page->loaded && page->cow)
+	{
+		if (copied)
+		{
+			if (vf->physical_address == zero_frame)
+			{
+				zero_copy_cnt++;
+				rss_add(page->owner, 1);
 			}
-			lock_release(&l[LOCK_SWAP]);
+			memcpy(kpage, page->physical_address, PGSIZE);
+			if (pinned)
+				VM_pin(false, page->physical_address, true);
+			lock_acquire(&nf->page_list_lock);
+			list_push_back(&nf->shared_pages, &page->frame_elem);
+			lock_release(&nf->page_list_lock);
+			page->physical_address = kpage;
+			cow_copy_cnt++;
 		}
 
-		//clear mappings from thread's pagedir
+		page->cow = false;
 		pagedir_clear_page(page->pagedir, page->virtual_address);
-		free(page);
+		pagedir_set_page(page->pagedir, page->virtual_address,
+				page->physical_address, true);
+		pagedir_set_dirty(page->pagedir, page->virtual_address, true);
+		pagedir_set_accessed(page->pagedir, page->virtual_address, true);
+	}
+	lock_release(&l[LOCK_EVICT]);
+
+	if (kpage != NULL && !copied)
+		VM_free_frame(kpage, NULL);
+	else if (copied && !pinned)
+		VM_pin(false, kpage, true);
+	return true;
+}
+
+//maps the zero page PAGE, on a read fault, to the shared zero frame. It gets
+//a frame of its own on the first write, through VM_cow_break().
+bool VM_map_zero(struct page_struct *page)
+{
+	struct frame_struct *vf = address_to_frame(zero_frame);
+
+	page->physical_address = zero_frame;
+	page->cow = true;
+	lock_acquire(&vf->page_list_lock);
+	list_push_back(&vf->shared_pages, &page->frame_elem);
+	lock_release(&vf->page_list_lock);
+	if (!page_install(page, true))
+	{
+		lock_acquire(&vf->page_list_lock);
+		list_remove(&page->frame_elem);
+		lock_release(&vf->page_list_lock);
+		page->physical_address = NULL;
+		page->cow = false;
+		return false;
+	}
+	zero_map_cnt++;
+	return true;
+}
+
+//returns true if every page that maps VF is a resident anonymous page of a
+//process, and if SINGLE, VF has exactly one page
+static bool merge_candidate(struct frame_struct *vf, bool single)
+{
+	struct list_elem *e;
+	bool ok;
+
+	if (vf->persistent || vf->share_bid != -1
+			|| vf->physical_address == zero_frame)
+		return false;
+	lock_acquire(&vf->page_list_lock);
+	ok = !list_empty(&vf->shared_pages)
+			&& (!single || list_size(&vf->shared_pages) == 1);
+	for (e = list_begin(&vf->shared_pages);
+			ok && e != list_end(&vf->shared_pages); e = list_next(e))
+	{
+		struct page_struct *page = list_entry(e, struct page_struct,
+				frame_elem);
+		ok = page->type != TYPE_FILE && page->writable && page->loaded;
+	}
+	lock_release(&vf->page_list_lock);
+	return ok;
+}
+
+//makes the pages of VF read-only copy-on-write, so that its contents stay
+//as they are until one of them is written
+static void merge_protect(struct frame_struct *vf)
+{
+	struct list_elem *e;
+
+	lock_acquire(&vf->page_list_lock);
+	for (e = list_begin(&vf->shared_pages); e != list_end(&vf->shared_pages);
+			e = list_next(e))
+	{
+		struct page_struct *page = list_entry(e, struct page_struct,
+				frame_elem);
+		page->cow = true;
+		pagedir_set_writable(page->pagedir, page->virtual_address, false);
+	}
+	lock_release(&vf->page_list_lock);
+}
+
+//undoes merge_protect() when the merge fails. A frame of several pages was
+//already shared copy-on-write before, and stays so.
+static void merge_unprotect(struct frame_struct *vf)
+{
+	struct page_struct *page;
+
+	lock_acquire(&vf->page_list_lock);
+	if (list_size(&vf->shared_pages) == 1)
+	{
+		page = list_entry(list_front(&vf->shared_pages), struct page_struct,
+				frame_elem);
+		page->cow = false;
+		pagedir_set_writable(page->pagedir, page->virtual_address, true);
+	}
+	lock_release(&vf->page_list_lock);
+}
+
+//returns true if the frame KPAGE holds the same data as the frame INTO, or
+//zeros if INTO is NULL
+static bool merge_same(void *kpage, void *into)
+{
+	return into != NULL ? memcmp(kpage, into, PGSIZE) == 0
+			: page_is_zero(kpage);
+}
+
+//merges the single anonymous page that maps the frame KPAGE into the frame
+//INTO if both hold the same data, or into the zero frame if INTO is NULL
+//and KPAGE holds zeros. The page then shares the frame copy-on-write, like
+//after a fork, and KPAGE is freed. Returns false if the frames do not
+//qualify or differ.
+bool VM_merge(void *kpage, void *into)
+{
+	struct frame_struct *vf, *nf;
+	struct page_struct *page;
+	bool merged = false;
+
+	//no page of either frame can be unloaded meanwhile
+	lock_acquire(&l[LOCK_EVICT]);
+	vf = address_to_frame(kpage);
+	nf = address_to_frame(into != NULL ? into : zero_frame);
+	if (vf == NULL || nf == NULL || vf == nf || !merge_candidate(vf, true)
+			|| (into != NULL && !merge_candidate(nf, false)))
+		goto done;
+
+	//compared before protecting, so that frames which differ keep their
+	//pages writable, and again after, as they may have been written between
+	if (!merge_same(kpage, into))
+		goto done;
+	merge_protect(vf);
+	if (into != NULL)
+		merge_protect(nf);
+	if (!merge_same(kpage, into))
+	{
+		merge_unprotect(vf);
+		if (into != NULL)
+			merge_unprotect(nf);
+		goto done;
+	}
+
+	lock_acquire(&vf->page_list_lock);
+	page = list_entry(list_pop_front(&vf->shared_pages), struct page_struct,
+			frame_elem);
+	lock_release(&vf->page_list_lock);
+	lock_acquire(&nf->page_list_lock);
+	list_push_back(&nf->shared_pages, &page->frame_elem);
+	lock_release(&nf->page_list_lock);
+
+	page->physical_address = nf->physical_address;
+	pagedir_clear_page(page->pagedir, page->virtual_address);
+	pagedir_set_page(page->pagedir, page->virtual_address,
+			page->physical_address, false);
+	pagedir_set_accessed(page->pagedir, page->virtual_address, true);
+	if (into == NULL)
+	{
+		//reads back as zeros, like a page never written
+		page->type = TYPE_ZERO;
+		rss_add(page->owner, -1);
+	}
+	else
+		//the shared copy is the only one, it must not be dropped
+		pagedir_set_dirty(page->pagedir, page->virtual_address, true);
+	merged = true;
+
+	done: lock_release(&l[LOCK_EVICT]);
+	if (merged)
+		VM_free_frame(kpage, NULL);
+	return merged;
+}
+
+//maps the whole 4 MB aligned block around the zero page PAGE, on a write
+//fault, with one large page when the block lies in a single writable region
+//without file data that nothing has touched yet. Returns false if it does
+//not, if the CPU has no 4 MB pages, if the process would go past its
+//resident set limit, or if no contiguous frames are free; the caller then
+//loads PAGE alone.
+bool VM_map_large(struct page_struct *page)
+{
+	uint8_t *upage = (uint8_t *) ((uintptr_t) page->virtual_address & PDMASK);
+	struct vma_struct *vma = VM_vma_find(page->virtual_address);
+	struct thread *t = page->owner;
+	uint8_t *kpage;
+	size_t i;
+
+	if (!init_large_pages
+			|| (t->rss_limit > 0 && t->rss + LARGE_PAGES > t->rss_limit))
+		return false;
+	if (vma == NULL || !vma->writable || vma->type == TYPE_STACK
+			|| upage < (uint8_t *) vma->start_address
+			|| upage + LARGE_PAGES * PGSIZE > (uint8_t *) vma->end_address
+			|| (vma->type == TYPE_FILE
+					&& (size_t) (upage - (uint8_t *) vma->start_address)
+							< vma->read_bytes))
+		return false;
+	for (i = 0; i < LARGE_PAGES; i++)
+		if (upage + i * PGSIZE != page->virtual_address
+				&& pagedir_peek(page->pagedir, upage + i * PGSIZE) != 0)
+			return false;
+
+	kpage = VM_get_large_frame();
+	if (kpage == NULL)
+		return false;
+
+	//every page gets its page_struct now, so each can be evicted on its own
+	for (i = 0; i < LARGE_PAGES; i++)
+	{
+		struct page_struct *p = page;
+		struct frame_struct *vf = address_to_frame(kpage + i * PGSIZE);
+
+		if (upage + i * PGSIZE != page->virtual_address)
+			p = VM_new_page(TYPE_ZERO, upage + i * PGSIZE, true, NULL, 0, 0, 0,
+					0);
+		if (p == NULL)
+			break;
+		p->physical_address = kpage + i * PGSIZE;
+		p->loaded = true;
+		lock_acquire(&vf->page_list_lock);
+		list_push_back(&vf->shared_pages, &p->frame_elem);
+		lock_release(&vf->page_list_lock);
+	}
+
+	if (i < LARGE_PAGES
+			|| !pagedir_set_large(page->pagedir, upage, kpage, true))
+	{
+		for (i = 0; i < LARGE_PAGES; i++)
+		{
+			struct frame_struct *vf = address_to_frame(kpage + i * PGSIZE);
+			struct page_struct *p;
+
+			if (!list_empty(&vf->shared_pages))
+			{
+				p = list_entry(list_pop_front(&vf->shared_pages),
+						struct page_struct, frame_elem);
+				p->physical_address = NULL;
+				p->loaded = false;
+				if (p != page)
+					VM_operation_page(OP_FREE, p, NULL, NULL);
+			}
+			VM_free_frame(kpage + i * PGSIZE, NULL);
+		}
+		return false;
+	}
+
+	for (i = 0; i < LARGE_PAGES; i++)
+		VM_pin(false, kpage + i * PGSIZE, true);
+	rss_add(page->owner, LARGE_PAGES);
+	large_fault_cnt++;
+	return true;
+}
+
+//prints statistics of the virtual memory subsystem
+void VM_print_stats(void)
+{
+	printf("VM: %lld file faults, %lld pages mapped by fault-around\n",
+			file_fault_cnt, fault_around_cnt);
+	printf("VM: %lld text pages mapped from shared frames\n", share_cnt);
+	printf("VM: %lld pages shared by fork, %lld copied on write\n",
+			fork_share_cnt, cow_copy_cnt);
+	printf("VM: %lld zero frame mappings, %lld later written, "
+			"%lld frames saved\n", zero_map_cnt, zero_copy_cnt,
+			zero_map_cnt - zero_copy_cnt);
+	printf("VM: %lld all-zero pages dropped instead of swapped\n",
+			zero_drop_cnt);
+	printf("VM: %lld write faults mapped a 4 MB page\n", large_fault_cnt);
+	printf("VM: peak resident set %d pages, peak working set %d pages "
+			"in %lld samples\n", rss_peak, wss_peak, wss_sample_cnt);
+	VM_print_frame_stats();
+	printf("VM: %lld pages swapped out, %lld swapped in\n", swap_out_cnt,
+			swap_in_cnt);
+	VM_print_swap_stats();
+	printf("VM: %lld evicted pages compacted, %lld expanded again\n",
+			compact_cnt, expand_cnt);
+	//what the page_structs of torn down address spaces took per GB mapped,
+	//against one for every page
+	if (teardown_page_cnt + teardown_compact_cnt > 0)
+		printf("VM: %lld page_structs and %lld compact entries torn down, "
+				"%lld kB of page_structs per mapped GB, %lld kB without "
+				"compact entries\n", teardown_page_cnt, teardown_compact_cnt,
+				(long long) sizeof(struct page_struct) * teardown_page_cnt
+						* (1 << 18) / (teardown_page_cnt + teardown_compact_cnt)
+						/ 1024,
+				(long long) sizeof(struct page_struct) * (1 << 18) / 1024);
+	printf("VM: %lld mmap pages written back in %lld batches, "
+			"%lld clean pages skipped\n", sync_page_cnt, sync_batch_cnt,
+			sync_clean_cnt);
+	printf("VM: %lld pages dropped behind sequential scans, "
+			"%lld by MADV_DONTNEED\n", drop_behind_cnt, dontneed_cnt);
+	printf("VM: %lld user buffer pages pinned in %lld ranges\n",
+			pin_page_cnt, pin_range_cnt);
+	printf("VM: %lld pages torn down in %lld batches, %lld frames and "
+			"%lld swap slots freed, %lld file pages written\n",
+			teardown_page_cnt, teardown_batch_cnt, teardown_frame_cnt,
+			teardown_slot_cnt, teardown_write_cnt);
+	VM_print_prefetch_stats();
+	VM_print_ksm_stats();
+}
+
+//maps the read-only file page PAGE to the frame of another process that
+//already holds the same inode block. Returns false if there is none.
+static bool page_share(struct page_struct *page)
+{
+	struct frame_struct key;
+	struct frame_struct *vf = NULL;
+	struct hash_elem *e;
+
+	if (page->type != TYPE_FILE || page->writable || page->bid == -1)
+		return false;
+
+	key.share_inode = inode_get_inumber(file_get_inode(page->file));
+	key.share_bid = page->bid;
+
+	//no frame can be freed while the eviction lock is held
+	lock_acquire(&l[LOCK_EVICT]);
+	lock_acquire(&l[LOCK_SHARE]);
+	e = hash_find(&hash_share, &key.share_elem);
+	if (e != NULL)
+		vf = hash_entry(e, struct frame_struct, share_elem);
+	lock_release(&l[LOCK_SHARE]);
+
+	if (vf != NULL)
+	{
+		lock_acquire(&vf->page_list_lock);
+		list_push_back(&vf->shared_pages, &page->frame_elem);
+		lock_release(&vf->page_list_lock);
+		page->physical_address = vf->physical_address;
+		if (!page_install(page, true))
+		{
+			lock_acquire(&vf->page_list_lock);
+			list_remove(&page->frame_elem);
+			lock_release(&vf->page_list_lock);
+			page->physical_address = NULL;
+			vf = NULL;
+		}
+		else
+			share_cnt++;
+	}
+	lock_release(&l[LOCK_EVICT]);
+	return vf != NULL;
+}
+
+//enters the frame of the loaded read-only file page PAGE in the shared text
+//table
+static void page_publish(struct page_struct *page)
+{
+	struct frame_struct *vf;
+
+	if (page->type != TYPE_FILE || page->writable || page->bid == -1)
+		return;
+	vf = address_to_frame(page->physical_address);
+	if (vf == NULL || vf->share_bid != -1)
+		return;
+
+	lock_acquire(&l[LOCK_SHARE]);
+	vf->share_inode = inode_get_inumber(file_get_inode(page->file));
+	vf->share_bid = page->bid;
+	if (hash_insert(&hash_share, &vf->share_elem) != NULL)
+		vf->share_bid = -1;
+	lock_release(&l[LOCK_SHARE]);
+}
+
+//copies the page of PARENT at UPAGE, whose page table entry is PTE, into the
+//current process. Called with the eviction lock held.
+static bool page_fork(struct thread *parent, void *upage, uint32_t pte)
+{
+	struct thread *cur = thread_current();
+	struct mmap_struct *pmf = mmap_of(parent, upage);
+	struct page_struct *pp, *page;
+	struct frame_struct *vf;
+
+	//a compact entry is copied as it is, with a swap slot of its own
+	if ((pte & PTE_P) == 0 && (pte & PTE_COMPACT))
+	{
+		size_t slot = pte >> PTE_COMPACT_SHIFT;
+		if (slot != 0)
+		{
+			size_t copy = VM_swap_duplicate(slot - 1);
+			if (copy == BITMAP_ERROR)
+				return false;
+			pte = compact_encode(false, copy, (pte & PTE_COMPACT_W) != 0);
+		}
+		pagedir_op_page(cur->pagedir, upage, (void *) pte);
 		return true;
 	}
+
+	if (pte & PTE_P)
+		pp = VM_frame_page(pte_get_page(pte), parent->pagedir, upage);
 	else
+		pp = (struct page_struct *) pte;
+	if (pp == NULL)
+		return false;
+
+	page = (struct page_struct *) malloc(sizeof(struct page_struct));
+	if (page == NULL)
+		return false;
+	memcpy(page, pp, sizeof(struct page_struct));
+	page->pagedir = cur->pagedir;
+	page->owner = cur;
+	if (page->type == TYPE_FILE && page->file == parent->exec)
+		page->file = cur->exec;
+
+	if (!pp->loaded)
 	{
+		page->physical_address = NULL;
+		page->cow = false;
+		if (page->type == TYPE_SWAP)
+		{
+			page->index = VM_swap_duplicate(pp->index);
+			if (page->index == BITMAP_ERROR)
+			{
+				free(page);
+				return false;
+			}
+		}
+		pagedir_op_page(page->pagedir, upage, (void *) page);
+		return true;
+	}
+
+	//private writable pages, anonymous mappings among them, are shared
+	//read-only until either side writes. Frames of mapped files stay
+	//writable in both processes.
+	if (pp->writable && (pmf == NULL || pmf->mfile == NULL))
+	{
+		pp->cow = page->cow = true;
+		pagedir_set_writable(parent->pagedir, upage, false);
+	}
+
+	vf = address_to_frame(pp->physical_address);
+	lock_acquire(&vf->page_list_lock);
+	list_push_back(&vf->shared_pages, &page->frame_elem);
+	lock_release(&vf->page_list_lock);
+	if (!pagedir_set_page(page->pagedir, upage, page->physical_address,
+			page->writable && !page->cow))
+	{
+		lock_acquire(&vf->page_list_lock);
+		list_remove(&page->frame_elem);
+		lock_release(&vf->page_list_lock);
+		free(page);
 		return false;
 	}
-	return false;
+	pagedir_set_dirty(page->pagedir, upage,
+			pagedir_is_dirty(parent->pagedir, upage));
+	pagedir_set_accessed(page->pagedir, upage, true);
+	if (page->physical_address != zero_frame)
+		rss_add(cur, 1);
+	fork_share_cnt++;
+	return true;
 }
 
+//returns the mapping of T that covers UPAGE, or NULL
+static struct mmap_struct *mmap_of(struct thread *t, void *upage)
+{
+	struct list_elem *e;
+
+	for (e = list_begin(&t->mmap_files); e != list_end(&t->mmap_files);
+			e = list_next(e))
+	{
+		struct mmap_struct *mf = list_entry(e, struct mmap_struct,
+				thread_mmap_list);
+		if (upage >= mf->start_address && upage < mf->end_address)
+			return mf;
+	}
+	return NULL;
+}
+
+//returns true if the page at KPAGE holds nothing but zeros
+static bool page_is_zero(const void *kpage)
+{
+	const uint32_t *word = kpage;
+	size_t i;
+
+	for (i = 0; i < PGSIZE / sizeof *word; i++)
+		if (word[i] != 0)
+			return false;
+	return true;
+}
+
+//gets an empty (pinned) frame for PAGE and adds PAGE to the frame's list of
+//sharers
+static bool page_get_frame(struct page_struct *page)
+{
+	//a process at its limit makes room among its own pages first
+	VM_evict_local(page->owner);
+
+	lock_acquire(&l[LOCK_LOAD]);
+	if (page->physical_address == NULL)
+		page->physical_address = VM_get_frame(NULL, NULL,
+				page->type == TYPE_ZERO ? PAL_USER | PAL_ZERO : PAL_USER);
+	lock_release(&l[LOCK_LOAD]);
+
+	struct frame_struct *vf = address_to_frame(page->physical_address);
+	if (vf == NULL)
+		return false;
+	lock_acquire(&vf->page_list_lock);
+	list_push_back(&vf->shared_pages, &page->frame_elem);
+	lock_release(&vf->page_list_lock);
+	VM_frame_loaded(vf, page);
+	return true;
+}
+
+//maps the frame of PAGE at its virtual address, clean and with the accessed
+//bit set to ACCESSED
+static bool page_install(struct page_struct *page, bool accessed)
+{
+	pagedir_clear_page(page->pagedir, page->virtual_address);
+	if (!pagedir_set_page(page->pagedir, page->virtual_address,
+			page->physical_address, page->writable && !page->cow))
+		return false;
+
+	pagedir_set_dirty(page->pagedir, page->virtual_address, false);
+	pagedir_set_accessed(page->pagedir, page->virtual_address, accessed);
+	if (!page->loaded && page->physical_address != zero_frame)
+		rss_add(page->owner, 1);
+	page->loaded = true;
+	page_publish(page);
+	return true;
+}
+
+//adds the page at ADDRESS to the stack. The stack region only covers the
+//pages the stack has grown into, so it is first extended down to ADDRESS,
+//which fails if another region is in the way.
 struct page_struct *VM_stack_grow(void *address, bool pin)
 {
 	struct page_struct *page = NULL;
-	page = VM_new_page(TYPE_ZERO, address, true, NULL,
-	NULL, NULL, NULL, NULL);
+	struct vma_struct *stack = VM_vma_find((uint8_t *) PHYS_BASE - 1);
+	void *upage = pg_round_down(address);
+
+	if (stack == NULL || stack->type != TYPE_STACK)
+		return NULL;
+	if (upage < stack->start_address)
+	{
+		if (VM_vma_overlaps(upage, stack->start_address))
+			return NULL;
+		//keeps its place in the tree, as nothing lies in between
+		stack->start_address = upage;
+	}
+	page = VM_new_page(TYPE_ZERO, upage, true, NULL, 0, 0, 0, 0);
 	if (page != NULL)
 	{
 		bool success = VM_operation_page(OP_LOAD, page, page->physical_address,
@@ -339,11 +1132,402 @@ struct page_struct *VM_find_page(void *address)
 		page = (struct page_struct *) pagedir_op_page(pagedir,
 				(const void *) address, NULL);
 
+		//first touch of a page of a region
+		if (page == NULL)
+			page = VM_vma_page(pg_round_down(address));
 		return page;
 	}
 	return NULL;
 }
 
+//a batch of the pages of a teardown. While the batch is open, the
+//eviction and frame table locks are held.
+struct teardown
+{
+	uint32_t *pd; //page directory whose pages are freed
+	bool live; //PD is still in use, so its entries are cleared
+	bool locked; //the locks are held
+	size_t cnt; //pages in the batch
+	size_t frame_cnt; //frames no page maps any more
+	size_t write_cnt; //dirty pages of mapped files
+	size_t slot_cnt; //swap slots of swapped out pages and compact entries
+	struct page_struct *pages[TEARDOWN_BATCH];
+	struct frame_struct *frames[TEARDOWN_BATCH];
+	struct page_struct *writes[TEARDOWN_BATCH];
+	size_t slots[TEARDOWN_BATCH];
+};
+
+//adds the page UPAGE, whose page table entry is ENTRY, to the batch of TD.
+//If LARGE, ENTRY is the directory entry of the 4 MB page holding UPAGE.
+//The page is taken off its frame, and the frame off the frame table if no
+//other page maps it. A dirty page of a mapped file is written back when
+//the batch is flushed, unless another process still maps its frame;
+//anything else is dropped.
+static void teardown_page(struct teardown *td, uint8_t *upage,
+		uint32_t *entry, bool large)
+{
+	struct page_struct *page = NULL, *other = NULL;
+	struct frame_struct key, *vf = NULL;
+	struct hash_elem *he;
+	struct list_elem *e;
+	bool unshared = false;
+	uint32_t pte;
+
+	if (!td->locked)
+	{
+		lock_acquire(&l[LOCK_EVICT]);
+		lock_acquire(&l[LOCK_FRAME]);
+		td->locked = true;
+	}
+
+	//read under the locks, an eviction may just have unloaded the page
+	pte = *entry;
+	if (large)
+		pte = ((pte & PDMASK) + pt_no(upage) * PGSIZE) | PTE_P;
+	if ((pte & PTE_P) == 0 && (pte & PTE_COMPACT))
+	{
+		if (pte >> PTE_COMPACT_SHIFT != 0)
+			td->slots[td->slot_cnt++] = (pte >> PTE_COMPACT_SHIFT) - 1;
+		if (td->live)
+			pagedir_clear_page(td->pd, upage);
+		teardown_compact_cnt++;
+		if (td->slot_cnt == TEARDOWN_BATCH)
+			teardown_flush(td);
+		return;
+	}
+	if ((pte & PTE_P) == 0)
+		page = (struct page_struct *) pte;
+	else
+	{
+		key.physical_address = pte_get_page(pte);
+		he = hash_find(&hash_frame, &key.hash_elem);
+		if (he != NULL)
+			vf = hash_entry(he, struct frame_struct, hash_elem);
+	}
+
+	if (vf != NULL)
+	{
+		lock_acquire(&vf->page_list_lock);
+		for (e = list_begin(&vf->shared_pages);
+				e != list_end(&vf->shared_pages); e = list_next(e))
+		{
+			struct page_struct *p = list_entry(e, struct page_struct,
+					frame_elem);
+			if (p->pagedir == td->pd && p->virtual_address == upage)
+			{
+				list_remove(&p->frame_elem);
+				page = p;
+				break;
+			}
+		}
+		unshared = list_empty(&vf->shared_pages);
+		if (!unshared)
+			other = list_entry(list_front(&vf->shared_pages),
+					struct page_struct, frame_elem);
+		lock_release(&vf->page_list_lock);
+	}
+
+	if (page == NULL)
+		return;
+	if (vf != NULL)
+	{
+		if (page->type == TYPE_FILE && pagedir_is_dirty(td->pd, upage)
+				&& !file_check_write(page->file))
+		{
+			//a frame of a mapped file is written back once, by the last
+			//process that maps it, so a frame still shared passes its dirty
+			//bit on
+			if (unshared)
+				td->writes[td->write_cnt++] = page;
+			else
+				pagedir_set_dirty(other->pagedir, other->virtual_address, true);
+		}
+		if (vf->physical_address != zero_frame)
+		{
+			rss_add(page->owner, -1);
+			if (unshared)
+			{
+				hash_delete(&hash_frame, &vf->hash_elem);
+				list_remove(&vf->frame_list_elem);
+				td->frames[td->frame_cnt++] = vf;
+			}
+		}
+	}
+	if (td->live)
+		pagedir_clear_page(td->pd, upage);
+	if (!page->loaded && page->type == TYPE_SWAP)
+		td->slots[td->slot_cnt++] = page->index;
+	td->pages[td->cnt++] = page;
+	if (td->cnt == TEARDOWN_BATCH || td->slot_cnt == TEARDOWN_BATCH)
+		teardown_flush(td);
+}
+
+//closes the batch of TD: drops the locks, then releases its swap slots
+//under one acquisition of the swap lock, writes its dirty file
+//pages under one acquisition of file_lock, and frees its frames and pages.
+static void teardown_flush(struct teardown *td)
+{
+	size_t i;
+
+	if (!td->locked)
+		return;
+	lock_release(&l[LOCK_FRAME]);
+
+	//text frames nobody maps can no longer be shared
+	lock_acquire(&l[LOCK_SHARE]);
+	for (i = 0; i < td->frame_cnt; i++)
+		if (td->frames[i]->share_bid != -1)
+			hash_delete(&hash_share, &td->frames[i]->share_elem);
+	lock_release(&l[LOCK_SHARE]);
+	lock_release(&l[LOCK_EVICT]);
+	td->locked = false;
+
+	VM_swap_free_multiple(td->slots, td->slot_cnt);
+	teardown_slot_cnt += td->slot_cnt;
+
+	if (td->write_cnt > 0)
+	{
+		lock_acquire(&file_lock);
+		for (i = 0; i < td->write_cnt; i++)
+			file_write_at(td->writes[i]->file,
+					td->writes[i]->physical_address,
+					td->writes[i]->read_bytes, td->writes[i]->offset);
+		lock_release(&file_lock);
+		for (i = 0; i < td->write_cnt; i++)
+			VM_pin(false, td->writes[i]->physical_address, true);
+	}
+
+	for (i = 0; i < td->frame_cnt; i++)
+	{
+		palloc_free_page(td->frames[i]->physical_address);
+		free(td->frames[i]);
+	}
+	for (i = 0; i < td->cnt; i++)
+		free(td->pages[i]);
+
+	teardown_page_cnt += td->cnt;
+	teardown_frame_cnt += td->frame_cnt;
+	teardown_write_cnt += td->write_cnt;
+	teardown_batch_cnt++;
+	td->cnt = td->frame_cnt = td->write_cnt = td->slot_cnt = 0;
+}
+
+static void teardown_init(struct teardown *td, uint32_t *pd, bool live)
+{
+	td->pd = pd;
+	td->live = live;
+	td->locked = false;
+	td->cnt = td->frame_cnt = td->write_cnt = td->slot_cnt = 0;
+}
+
+//returns the compact page table entry of an anonymous page that is all
+//zeros if ZERO, else swapped out in slot INDEX
+static uint32_t compact_encode(bool zero, size_t index, bool writable)
+{
+	uint32_t pte = PTE_COMPACT | (writable ? PTE_COMPACT_W : 0);
+
+	if (!zero)
+		pte |= (uint32_t) (index + 1) << PTE_COMPACT_SHIFT;
+	return pte;
+}
+
+//remembers the page PAGE, just evicted, so that its process can replace its
+//page_struct with a compact entry. The process does it itself, where it
+//holds no page_struct pointers, since code of the process may still hold
+//PAGE now. Called with the eviction lock held.
+void VM_compact_note(struct page_struct *page)
+{
+	struct thread *t = page->owner;
+
+	if (page->type != TYPE_FILE && t->compact_cnt < COMPACT_PAGES)
+		t->compact_pages[t->compact_cnt++] = page->virtual_address;
+}
+
+//replaces the page_structs of the anonymous pages of the current process
+//that were evicted since it last entered the kernel with compact entries.
+//Only called on entry to the kernel from user mode.
+void VM_compact_pages(void)
+{
+	struct thread *t = thread_current();
+	int i;
+
+	if (t->compact_cnt == 0)
+		return;
+	lock_acquire(&l[LOCK_EVICT]);
+	for (i = 0; i < t->compact_cnt; i++)
+	{
+		uint32_t *pte = pagedir_lookup(t->pagedir, t->compact_pages[i]);
+		struct page_struct *page;
+
+		//the page may have come back, or been unmapped, since
+		if (pte == NULL || *pte == 0 || (*pte & (PTE_P | PTE_COMPACT)))
+			continue;
+		page = (struct page_struct *) *pte;
+		if (page->loaded || page->type == TYPE_FILE)
+			continue;
+		*pte = compact_encode(page->type == TYPE_ZERO, page->index,
+				page->writable);
+		free(page);
+		compact_cnt++;
+	}
+	t->compact_cnt = 0;
+	lock_release(&l[LOCK_EVICT]);
+}
+
+//gives the page UPAGE of the current process, held by the compact entry at
+//PTE in its page directory PD, its page_struct back. Returns NULL if out of
+//memory.
+struct page_struct *VM_expand_page(uint32_t *pd, void *upage, uint32_t *pte)
+{
+	struct page_struct *p;
+	size_t slot = *pte >> PTE_COMPACT_SHIFT;
+
+	ASSERT(pd == thread_current()->pagedir);
+	p = (struct page_struct *) malloc(sizeof(struct page_struct));
+	if (p == NULL)
+		return NULL;
+	p->type = slot == 0 ? TYPE_ZERO : TYPE_SWAP;
+	p->virtual_address = upage;
+	p->physical_address = NULL;
+	p->writable = (*pte & PTE_COMPACT_W) != 0;
+	p->cow = false;
+	p->loaded = false;
+	p->index = slot == 0 ? 0 : slot - 1;
+	p->pagedir = pd;
+	p->owner = thread_current();
+	p->file = NULL;
+	*pte = (uint32_t) p;
+	expand_cnt++;
+	return p;
+}
+
+//frees every user page of the page directory PD of an exiting process, in
+//one walk of PD and in batches of TEARDOWN_BATCH pages: resident frames no
+//other process shares go back to the user pool, swap slots are released,
+//and nothing is written to swap. The page tables are left to the caller.
+void VM_free_pages(uint32_t *pd)
+{
+	struct teardown td;
+	uint32_t *pde, *pt;
+	size_t i;
+
+	teardown_init(&td, pd, false);
+	for (pde = pd; pde < pd + pd_no(PHYS_BASE); pde++)
+	{
+		uint8_t *base = (uint8_t *) ((uintptr_t) (pde - pd) << PDSHIFT);
+
+		if ((*pde & PTE_P) == 0)
+			continue;
+		if (*pde & PTE_PS)
+		{
+			for (i = 0; i < LARGE_PAGES; i++)
+				teardown_page(&td, base + i * PGSIZE, pde, true);
+			continue;
+		}
+		pt = pde_get_pt(*pde);
+		for (i = 0; i < PGSIZE / sizeof *pt; i++)
+			if (pt[i] != 0)
+				teardown_page(&td, base + i * PGSIZE, &pt[i], false);
+	}
+	teardown_flush(&td);
+}
+
+//frees the pages of the current process in [START, END) and their swap
+//slots, batched like VM_free_pages(). Dirty pages of a mapped file are
+//expected to have been synced, anonymous contents are dropped without
+//going to swap.
+void VM_unmap_range(void *start, void *end)
+{
+	struct teardown td;
+	uint8_t *upage;
+
+	teardown_init(&td, thread_current()->pagedir, true);
+	pagedir_batch_begin();
+	for (upage = start; upage < (uint8_t *) end; upage += PGSIZE)
+	{
+		uint32_t *pte = pagedir_lookup(td.pd, upage);
+		if (pte != NULL && *pte != 0)
+			teardown_page(&td, upage, pte, false);
+	}
+	teardown_flush(&td);
+	pagedir_batch_end();
+}
+
+//makes the user page of the current process that holds ADDR resident and
+//pins its frame. A new page grows the stack if ADDR is at most 32 bytes
+//below ESP. WRITE breaks copy-on-write, and fails for read-only pages.
+static bool page_pin(const void *addr, bool write, const void *esp)
+{
+	void *upage = pg_round_down(addr);
+	struct page_struct *page = VM_find_page(upage);
+	bool pinned = false;
+
+	if (page == NULL)
+	{
+		if (upage == NULL || addr < esp - 32
+				|| (uint8_t *) PHYS_BASE - (uint8_t *) upage > STACK_SIZE)
+			return false;
+		return VM_stack_grow(upage, true) != NULL;
+	}
+	if (write && !page->writable)
+		return false;
+
+	//not unloaded between the check and the pin
+	lock_acquire(&l[LOCK_EVICT]);
+	if (page->loaded)
+		pinned = VM_pin(true, page->physical_address, true)
+				|| page->physical_address == zero_frame;
+	lock_release(&l[LOCK_EVICT]);
+
+	if (!pinned && !VM_operation_page(OP_LOAD, page, page->physical_address,
+			true))
+		return false;
+	if (write && page->cow)
+		return VM_cow_break(page, true);
+	return true;
+}
+
+//faults in and pins every page of the user buffer [BUFFER, BUFFER + SIZE),
+//so that a system call can copy all of it under a single acquisition of
+//file_lock without faulting. WRITE means the kernel writes into the buffer.
+//Returns false, with nothing left pinned, if a page is not valid.
+bool VM_pin_range(const void *buffer, size_t size, bool write,
+		const void *esp)
+{
+	uint8_t *start = pg_round_down(buffer);
+	uint8_t *upage;
+
+	if (size == 0)
+		return true;
+	for (upage = start; upage < (uint8_t *) buffer + size; upage += PGSIZE)
+		if (!page_pin(upage < start + PGSIZE ? buffer : upage, write, esp))
+		{
+			if (upage > start)
+				VM_unpin_range(start, upage - start);
+			return false;
+		}
+	pin_range_cnt++;
+	pin_page_cnt += (upage - start) / PGSIZE;
+	return true;
+}
+
+//unpins the pages of a buffer pinned by VM_pin_range().
+void VM_unpin_range(const void *buffer, size_t size)
+{
+	uint32_t *pd = thread_current()->pagedir;
+	uint8_t *upage;
+
+	if (size == 0)
+		return;
+	for (upage = pg_round_down(buffer); upage < (uint8_t *) buffer + size;
+			upage += PGSIZE)
+	{
+		void *kpage = pagedir_get_page(pd, upage);
+		if (kpage != NULL)
+			VM_pin(false, pg_round_down(kpage), true);
+	}
+}
+
 unsigned frame_hash(const struct hash_elem *f_, void *aux UNUSED)
 {
 	const struct frame_struct *f = hash_entry(f_, struct frame_struct,
@@ -362,11 +1546,31 @@ bool frame_less_helper(const struct hash_elem *a_, const struct hash_elem *b_,
 	return a->physical_address < b->physical_address;
 }
 
+unsigned share_hash(const struct hash_elem *f_, void *aux UNUSED)
+{
+	const struct frame_struct *f = hash_entry(f_, struct frame_struct,
+			share_elem);
+	return hash_int((int) f->share_inode) ^ hash_int(f->share_bid);
+}
+
+bool share_less_helper(const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED)
+{
+	const struct frame_struct *a = hash_entry(a_, struct frame_struct,
+			share_elem);
+	const struct frame_struct *b = hash_entry(b_, struct frame_struct,
+			share_elem);
+
+	if (a->share_inode != b->share_inode)
+		return a->share_inode < b->share_inode;
+	return a->share_bid < b->share_bid;
+}
+
 unsigned mmap_hash(const struct hash_elem *mf_, void *aux UNUSED)
 {
 	const struct mmap_struct *mf = hash_entry(mf_, struct mmap_struct,
 			frame_hash_elem);
-	return hash_int((unsigned) mf->mapid);
+	return hash_int((unsigned) mf->mapid) ^ hash_int(mf->tid);
 }
 
 bool mmap_less_helper(const struct hash_elem *a_, const struct hash_elem *b_,
@@ -377,5 +1581,268 @@ bool mmap_less_helper(const struct hash_elem *a_, const struct hash_elem *b_,
 	const struct mmap_struct *b = hash_entry(b_, struct mmap_struct,
 			frame_hash_elem);
 
+	if (a->tid != b->tid)
+		return a->tid < b->tid;
 	return a->mapid < b->mapid;
 }
+
+//adds CNT to the resident set of T, which may be changed from the
+//eviction of another process
+static void rss_add(struct thread *t, int cnt)
+{
+	enum intr_level old_level = intr_disable();
+	t->rss += cnt;
+	if (t->rss > rss_peak)
+		rss_peak = t->rss;
+	intr_set_level(old_level);
+}
+
+//estimates the working set of the current process, at most every
+//WSS_TICKS timer ticks, as the number of its pages accessed since the
+//previous sample. Kernel threads have no pages to sample.
+void VM_sample_wss(void)
+{
+	struct thread *t = thread_current();
+	int64_t now = timer_ticks();
+
+	if (t->pagedir == NULL || now - t->wss_tick < WSS_TICKS)
+		return;
+	t->wss_tick = now;
+	t->wss = pagedir_sample_accessed(t->pagedir);
+	if (t->wss > wss_peak)
+		wss_peak = t->wss;
+	wss_sample_cnt++;
+}
+
+//writes the dirty resident pages of the current process's mapping MF back
+//to its file. A mapping starts at file offset 0, so walking it by address
+//writes in file order. Up to SYNC_BATCH dirty pages are pinned and then
+//written under a single acquisition of file_lock; clean pages never touch
+//the file. The pages stay mapped, and clean.
+void VM_mmap_sync(struct mmap_struct *mf)
+{
+	struct page_struct *batch[SYNC_BATCH];
+	uint32_t *pd = thread_current()->pagedir;
+	uint8_t *upage = mf->start_address;
+	size_t cnt, i;
+
+	if (mf->mfile == NULL || file_check_write(mf->mfile->file))
+		return;
+
+	while (upage < (uint8_t *) mf->end_address)
+	{
+		//nothing can be unloaded while the batch is collected
+		cnt = 0;
+		lock_acquire(&l[LOCK_EVICT]);
+		for (; upage < (uint8_t *) mf->end_address && cnt < SYNC_BATCH;
+				upage += PGSIZE)
+		{
+			struct page_struct *page = pagedir_op_page(pd, upage, NULL);
+
+			if (page == NULL || !page->loaded || page->type != TYPE_FILE)
+				continue;
+			if (!pagedir_is_dirty(pd, upage))
+			{
+				sync_clean_cnt++;
+				continue;
+			}
+			//a write from here on dirties the page again
+			VM_pin(true, page->physical_address, true);
+			pagedir_set_dirty(pd, upage, false);
+			batch[cnt++] = page;
+		}
+		lock_release(&l[LOCK_EVICT]);
+		if (cnt == 0)
+			continue;
+
+		lock_acquire(&file_lock);
+		for (i = 0; i < cnt; i++)
+			file_write_at(mf->mfile->file, batch[i]->physical_address,
+					batch[i]->read_bytes, batch[i]->offset);
+		lock_release(&file_lock);
+
+		for (i = 0; i < cnt; i++)
+			VM_pin(false, batch[i]->physical_address, true);
+		sync_page_cnt += cnt;
+		sync_batch_cnt++;
+	}
+}
+
+//applies the access hint ADVICE to the pages [ADDR, ADDR + SIZE) of the
+//current process, which must all lie in its regions. MADV_NORMAL,
+//MADV_SEQUENTIAL and MADV_RANDOM set the fault-around of every region the
+//range touches. MADV_WILLNEED queues its non-resident file pages for the
+//prefetch thread, MADV_DONTNEED drops its pages, which are then made again
+//from their region. Returns false for a bad range or hint.
+bool VM_madvise(void *addr, size_t size, int advice)
+{
+	uint32_t *pd = thread_current()->pagedir;
+	uint8_t *start = addr, *end = start + ROUND_UP(size, PGSIZE), *upage;
+	struct vma_struct *vma;
+	bool stack = false;
+
+	if (pg_ofs(addr) != 0 || size == 0 || end <= start
+			|| !is_user_vaddr(end - 1))
+		return false;
+	for (upage = start; upage < end; upage = vma->end_address)
+	{
+		vma = VM_vma_find(upage);
+		if (vma == NULL)
+			return false;
+		stack = stack || vma->type == TYPE_STACK;
+	}
+
+	switch (advice)
+	{
+	case MADV_NORMAL:
+	case MADV_SEQUENTIAL:
+	case MADV_RANDOM:
+		for (upage = start; upage < end; upage = vma->end_address)
+		{
+			vma = VM_vma_find(upage);
+			vma->advice = advice;
+		}
+		return true;
+	case MADV_WILLNEED:
+		for (upage = start; upage < end; upage += PGSIZE)
+		{
+			uint32_t pte = pagedir_peek(pd, upage);
+			struct page_struct *page;
+
+			//compact entries only hold anonymous pages
+			if ((pte & PTE_P) || (pte & PTE_COMPACT))
+				continue;
+			page = VM_find_page(upage);
+			if (page != NULL && !page->loaded && page->type == TYPE_FILE
+					&& !VM_prefetch(page))
+				break;
+		}
+		return true;
+	case MADV_DONTNEED:
+		//the stack would not come back
+		if (stack)
+			return false;
+		VM_prefetch_cancel(thread_current());
+		pagedir_batch_begin();
+		for (upage = start; upage < end; upage += PGSIZE)
+		{
+			uint32_t pte = pagedir_peek(pd, upage);
+			struct page_struct *page;
+
+			if ((pte & PTE_P) == 0 && (pte & PTE_COMPACT))
+			{
+				compact_drop(pd, upage, pte);
+				continue;
+			}
+			page = pte != 0 ? pagedir_op_page(pd, upage, NULL) : NULL;
+			if (page != NULL)
+				page_drop(page);
+		}
+		pagedir_batch_end();
+		return true;
+	}
+	return false;
+}
+
+//maps the file page PAGE to the pinned frame the prefetch thread has read
+//it into. Returns false if there is none.
+static bool page_prefetched(struct page_struct *page)
+{
+	void *kpage = VM_prefetch_take(page->owner, page->virtual_address);
+	struct frame_struct *vf;
+
+	if (kpage == NULL)
+		return false;
+
+	vf = address_to_frame(kpage);
+	page->physical_address = kpage;
+	lock_acquire(&vf->page_list_lock);
+	list_push_back(&vf->shared_pages, &page->frame_elem);
+	lock_release(&vf->page_list_lock);
+	if (!page_install(page, true))
+	{
+		lock_acquire(&vf->page_list_lock);
+		list_remove(&page->frame_elem);
+		lock_release(&vf->page_list_lock);
+		page->physical_address = NULL;
+		VM_free_frame(kpage, NULL);
+		return false;
+	}
+	return true;
+}
+
+//drops PAGE of the current process for MADV_DONTNEED. A dirty page of a
+//mapped file is written back first, anything else is discarded along with
+//its swap slot.
+static void page_drop(struct page_struct *page)
+{
+	void *kpage = page->physical_address;
+
+	if (page->loaded && kpage == zero_frame)
+	{
+		struct frame_struct *vf = address_to_frame(zero_frame);
+
+		lock_acquire(&vf->page_list_lock);
+		list_remove(&page->frame_elem);
+		lock_release(&vf->page_list_lock);
+		page->loaded = false;
+	}
+	else if (page->loaded)
+	{
+		struct mmap_struct *mf = mmap_of(thread_current(),
+				page->virtual_address);
+
+		//unloading then finds a clean zero page, and writes nothing
+		if (mf == NULL || mf->mfile == NULL)
+		{
+			pagedir_set_dirty(page->pagedir, page->virtual_address, false);
+			page->type = TYPE_ZERO;
+		}
+		VM_free_frame(kpage, page->pagedir);
+	}
+	VM_operation_page(OP_FREE, page, NULL, NULL);
+	dontneed_cnt++;
+}
+
+//discards the non-resident anonymous page UPAGE of the current process,
+//held by the compact entry PTE in its page directory PD, like page_drop()
+//but without giving it a page_struct first
+static void compact_drop(uint32_t *pd, void *upage, uint32_t pte)
+{
+	if (pte >> PTE_COMPACT_SHIFT != 0)
+		VM_swap_free((pte >> PTE_COMPACT_SHIFT) - 1);
+	pagedir_clear_page(pd, upage);
+	dontneed_cnt++;
+}
+
+//unloads the resident pages of the sequential region VMA that lie between
+//two and one fault-around windows behind UPAGE, where the scan is done
+static void drop_behind(struct vma_struct *vma, uint8_t *upage)
+{
+	uint32_t *pd = thread_current()->pagedir;
+	uint8_t *start = vma->start_address;
+	uint8_t *end;
+
+	if (upage - start <= FAULT_AROUND_MAX * PGSIZE)
+		return;
+	end = upage - FAULT_AROUND_MAX * PGSIZE;
+	if (end - start > FAULT_AROUND_MAX * PGSIZE)
+		start = end - FAULT_AROUND_MAX * PGSIZE;
+
+	pagedir_batch_begin();
+	for (; start < end; start += PGSIZE)
+	{
+		struct page_struct *p;
+
+		//only resident pages have a frame to free
+		if ((pagedir_peek(pd, start) & PTE_P) == 0)
+			continue;
+		p = pagedir_op_page(pd, start, NULL);
+		if (p != NULL && p->loaded && p->physical_address != zero_frame)
+		{
+			VM_free_frame(p->physical_address, pd);
+			drop_behind_cnt++;
+		}
+	}
+	pagedir_batch_end();
+}
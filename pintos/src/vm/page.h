@@ -14,11 +14,35 @@ bool VM_operation_page(int type, void *address, void * kpage, bool pinned);
 void VM_init(void);
 struct page_struct *VM_stack_grow(void *address, bool pin);
 struct page_struct *VM_find_page(void *address);
+bool VM_pin_range(const void *buffer, size_t size, bool write,
+		const void *esp);
+void VM_unpin_range(const void *buffer, size_t size);
+void VM_unmap_range(void *start, void *end);
+void VM_free_pages(uint32_t *pd);
+void VM_compact_note(struct page_struct *page);
+void VM_compact_pages(void);
+struct page_struct *VM_expand_page(uint32_t *pd, void *upage, uint32_t *pte);
+bool VM_fault_around(struct page_struct *page);
+struct thread;
+bool VM_fork(struct thread *parent);
+bool VM_cow_break(struct page_struct *page, bool pinned);
+bool VM_map_zero(struct page_struct *page);
+bool VM_map_large(struct page_struct *page);
+bool VM_merge(void *kpage, void *into);
+void VM_sample_wss(void);
+struct mmap_struct;
+void VM_mmap_sync(struct mmap_struct *mf);
+bool VM_madvise(void *addr, size_t size, int advice);
+void VM_print_stats(void);
 
 unsigned frame_hash(const struct hash_elem *f_, void *aux);
 bool frame_less_helper(const struct hash_elem *a_, const struct hash_elem *b_,
 		void *aux);
 
+unsigned share_hash(const struct hash_elem *f_, void *aux);
+bool share_less_helper(const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux);
+
 unsigned mmap_hash(const struct hash_elem *mf_, void *aux);
 bool mmap_less_helper(const struct hash_elem *a_, const struct hash_elem *b_,
 		void *aux);
@@ -0,0 +1,245 @@
+#include "vm/struct.h"
+#include "filesys/file.h"
+#include "filesys/inode.h"
+
+static struct list prefetch_queue; //prefetches not yet read, oldest first
+static struct lock prefetch_lock; //for the queue and the owners' lists
+static struct semaphore prefetch_sema; //counts the queue
+static struct prefetch_struct *prefetch_current; //the one being read
+
+static long long prefetch_read_cnt; //pages read ahead of their owner
+static long long prefetch_used_cnt; //of them, later mapped by the owner
+static long long prefetch_stale_cnt; //of them, dropped as the file was written
+
+static void prefetch_thread(void *aux);
+static struct prefetch_struct *prefetch_find(struct list *list,
+		struct thread *t, void *upage);
+static void prefetch_free(struct prefetch_struct *pf);
+
+//starts the prefetch thread
+void VM_prefetch_init(void)
+{
+	list_init(&prefetch_queue);
+	lock_init(&prefetch_lock);
+	sema_init(&prefetch_sema, 0);
+	thread_create("prefetch", PRI_DEFAULT, prefetch_thread, NULL);
+}
+
+//queues the non-resident file page PAGE of the current process to be read
+//in the background. Returns false if the process has too many prefetches
+//outstanding, or if memory runs out.
+bool VM_prefetch(struct page_struct *page)
+{
+	struct thread *t = thread_current();
+	struct prefetch_struct *pf;
+
+	if (t->prefetch_cnt >= PREFETCH_MAX)
+		return false;
+
+	pf = (struct prefetch_struct *) malloc(sizeof(struct prefetch_struct));
+	if (pf == NULL)
+		return false;
+
+	//the page's own file may be closed before the read
+	lock_acquire(&file_lock);
+	pf->file = file_reopen(page->file);
+	lock_release(&file_lock);
+	if (pf->file == NULL)
+	{
+		free(pf);
+		return false;
+	}
+	pf->owner = t;
+	pf->virtual_address = page->virtual_address;
+	pf->offset = page->offset;
+	pf->read_bytes = page->read_bytes;
+	pf->physical_address = NULL;
+
+	lock_acquire(&prefetch_lock);
+	if (prefetch_find(&prefetch_queue, t, pf->virtual_address) != NULL
+			|| prefetch_find(&t->prefetched, t, pf->virtual_address) != NULL)
+	{
+		lock_release(&prefetch_lock);
+		prefetch_free(pf);
+		return true;
+	}
+	list_push_back(&prefetch_queue, &pf->elem);
+	t->prefetch_cnt++;
+	lock_release(&prefetch_lock);
+	sema_up(&prefetch_sema);
+	return true;
+}
+
+//returns the pinned frame the prefetch thread has read UPAGE of T into, or
+//NULL. A prefetch of UPAGE that is not done yet is cancelled, as T is about
+//to read the page itself, and so is one whose file was written after it was
+//read.
+void *VM_prefetch_take(struct thread *t, void *upage)
+{
+	struct prefetch_struct *pf;
+	void *kpage = NULL;
+
+	if (t->prefetch_cnt == 0)
+		return NULL;
+
+	lock_acquire(&prefetch_lock);
+	pf = prefetch_find(&t->prefetched, t, upage);
+	if (pf != NULL)
+	{
+		list_remove(&pf->elem);
+		t->prefetch_cnt--;
+		if (file_get_inode(pf->file)->write_cnt == pf->write_cnt)
+		{
+			kpage = pf->physical_address;
+			pf->physical_address = NULL;
+			prefetch_used_cnt++;
+		}
+		else
+			prefetch_stale_cnt++;
+	}
+	else if ((pf = prefetch_find(&prefetch_queue, t, upage)) != NULL)
+	{
+		list_remove(&pf->elem);
+		t->prefetch_cnt--;
+	}
+	else if (prefetch_current != NULL && prefetch_current->owner == t
+			&& prefetch_current->virtual_address == upage)
+	{
+		prefetch_current->owner = NULL;
+		t->prefetch_cnt--;
+	}
+	lock_release(&prefetch_lock);
+
+	if (pf != NULL)
+		prefetch_free(pf);
+	return kpage;
+}
+
+//drops all prefetches of T, before its mappings or its address space go
+void VM_prefetch_cancel(struct thread *t)
+{
+	struct list dropped;
+	struct list_elem *e;
+
+	if (t->prefetch_cnt == 0)
+		return;
+
+	list_init(&dropped);
+	lock_acquire(&prefetch_lock);
+	while (!list_empty(&t->prefetched))
+		list_push_back(&dropped, list_pop_front(&t->prefetched));
+	for (e = list_begin(&prefetch_queue); e != list_end(&prefetch_queue);)
+	{
+		struct prefetch_struct *pf = list_entry(e, struct prefetch_struct,
+				elem);
+		e = list_next(e);
+		if (pf->owner == t)
+		{
+			list_remove(&pf->elem);
+			list_push_back(&dropped, &pf->elem);
+		}
+	}
+	//the thread frees it once the read is done
+	if (prefetch_current != NULL && prefetch_current->owner == t)
+		prefetch_current->owner = NULL;
+	t->prefetch_cnt = 0;
+	lock_release(&prefetch_lock);
+
+	while (!list_empty(&dropped))
+		prefetch_free(list_entry(list_pop_front(&dropped),
+				struct prefetch_struct, elem));
+}
+
+//prints statistics of prefetching
+void VM_print_prefetch_stats(void)
+{
+	printf("VM: %lld pages prefetched, %lld of them used, %lld stale\n",
+			prefetch_read_cnt, prefetch_used_cnt, prefetch_stale_cnt);
+}
+
+//reads the queued pages one at a time into pinned frames, and hands them to
+//their owners
+static void prefetch_thread(void *aux UNUSED)
+{
+	while (true)
+	{
+		struct prefetch_struct *pf;
+		void *kpage = NULL;
+		bool success = false;
+
+		sema_down(&prefetch_sema);
+		lock_acquire(&prefetch_lock);
+		if (list_empty(&prefetch_queue))
+		{
+			//cancelled meanwhile
+			lock_release(&prefetch_lock);
+			continue;
+		}
+		pf = list_entry(list_pop_front(&prefetch_queue), struct prefetch_struct,
+				elem);
+		prefetch_current = pf;
+		lock_release(&prefetch_lock);
+
+		if (pf->owner != NULL)
+			kpage = VM_get_frame(NULL, NULL, PAL_USER);
+		//the file stays open, for VM_prefetch_take() to see later writes
+		lock_acquire(&file_lock);
+		pf->write_cnt = file_get_inode(pf->file)->write_cnt;
+		if (kpage != NULL)
+			success = file_read_at(pf->file, kpage, pf->read_bytes, pf->offset)
+					== (off_t) pf->read_bytes;
+		lock_release(&file_lock);
+		if (success)
+			memset(kpage + pf->read_bytes, 0, PGSIZE - pf->read_bytes);
+
+		lock_acquire(&prefetch_lock);
+		prefetch_current = NULL;
+		if (success && pf->owner != NULL)
+		{
+			pf->physical_address = kpage;
+			list_push_back(&pf->owner->prefetched, &pf->elem);
+			prefetch_read_cnt++;
+			pf = NULL;
+		}
+		else if (pf->owner != NULL)
+			pf->owner->prefetch_cnt--;
+		lock_release(&prefetch_lock);
+
+		if (pf != NULL)
+		{
+			if (kpage != NULL)
+				VM_free_frame(kpage, NULL);
+			prefetch_free(pf);
+		}
+	}
+}
+
+//returns the prefetch of UPAGE for T in LIST, or NULL
+static struct prefetch_struct *prefetch_find(struct list *list,
+		struct thread *t, void *upage)
+{
+	struct list_elem *e;
+
+	for (e = list_begin(list); e != list_end(list); e = list_next(e))
+	{
+		struct prefetch_struct *pf = list_entry(e, struct prefetch_struct,
+				elem);
+		if (pf->owner == t && pf->virtual_address == upage)
+			return pf;
+	}
+	return NULL;
+}
+
+//frees PF, along with its frame if it was read
+static void prefetch_free(struct prefetch_struct *pf)
+{
+	if (pf->physical_address != NULL)
+		VM_free_frame(pf->physical_address, NULL);
+	if (pf->file != NULL)
+	{
+		lock_acquire(&file_lock);
+		file_close(pf->file);
+		lock_release(&file_lock);
+	}
+	free(pf);
+}
@@ -0,0 +1,16 @@
+#ifndef VM_PREFETCH_H
+#define VM_PREFETCH_H
+
+#include "vm/struct.h"
+#include <stdbool.h>
+
+struct thread;
+struct page_struct;
+
+void VM_prefetch_init(void);
+bool VM_prefetch(struct page_struct *page);
+void *VM_prefetch_take(struct thread *t, void *upage);
+void VM_prefetch_cancel(struct thread *t);
+void VM_print_prefetch_stats(void);
+
+#endif
@@ -6,11 +6,16 @@
 #include <bitmap.h>
 #include <hash.h>
 #include <list.h>
+#include <tree.h>
 #include <stdbool.h>
 #include <stddef.h>
 
 #include "vm/frame.h"
 #include "vm/page.h"
+#include "vm/vma.h"
+#include "vm/prefetch.h"
+#include "vm/ksm.h"
+#include "vm/swap.h"
 #include "userprog/syscall.h"
 #include "userprog/pagedir.h"
 #include "threads/malloc.h"
@@ -21,7 +26,7 @@
 #include "threads/pte.h"
 
 //an array of locks for various purposes
-#define NO_OF_LOCKS 7
+#define NO_OF_LOCKS 8
 struct lock l[NO_OF_LOCKS];
 #define LOCK_LOAD 0
 #define LOCK_UNLOAD 1
@@ -30,11 +35,42 @@ struct lock l[NO_OF_LOCKS];
 #define LOCK_EVICT 4
 #define LOCK_SWAP 5
 #define LOCK_MMAP 6
+#define LOCK_SHARE 7
 
 //determines the type of the file
 #define TYPE_ZERO 0
 #define TYPE_FILE 1
 #define TYPE_SWAP 2
+#define TYPE_STACK 3 //only for regions, its pages are TYPE_ZERO
+
+//most the stack region may grow to below PHYS_BASE
+#define STACK_SIZE (1 << 23)
+
+//4 kB pages in a 4 MB large page
+#define LARGE_PAGES (1 << PTBITS)
+
+//timer ticks between two working-set samples of a process
+#define WSS_TICKS 25
+
+//dirty mmap pages written back per acquisition of the file system lock
+#define SYNC_BATCH 32
+
+//user buffer pages a read or write system call pins at once
+#define PIN_CHUNK_PAGES 64
+
+//pages a teardown frees per acquisition of the eviction lock
+#define TEARDOWN_BATCH 32
+
+//prefetches a process may have outstanding
+#define PREFETCH_MAX 64
+
+//a non-present page table entry with PTE_COMPACT set holds an anonymous
+//page with no page_struct: PTE_COMPACT_W is its writable bit, and the bits
+//from PTE_COMPACT_SHIFT on hold its swap slot plus one, or 0 for a
+//page of zeros. A page_struct pointer is word aligned, so never has the tag.
+#define PTE_COMPACT 0x2
+#define PTE_COMPACT_W 0x4
+#define PTE_COMPACT_SHIFT 3
 
 //instructs the load function to perform required operation
 #define OP_LOAD 0
@@ -51,9 +87,11 @@ struct page_struct
 	void *virtual_address; //virtual address of page.
 	void *physical_address; // Physical address of the page
 	bool writable; //determines if page is writable
+	bool cow; //shares its frame copy-on-write with a forked process
 	uint32_t *pagedir; // pagedir of page
+	struct thread *owner; //process whose resident set the page counts in
 	struct list_elem frame_elem; //list_elem for shared frame
-	size_t index; //index of swap block
+	size_t index; //swap slot of a swapped out page
 	bool loaded; //determines if page is loaded
 	struct file *file; //the file struct of the page
 	off_t offset; /* Offset in the file. */
@@ -63,12 +101,69 @@ struct page_struct
 
 };
 
+/********************************
+ * For VMA
+ */
+//a region of a process's address space. Pages of a region get their
+//page_struct only when they are first touched.
+struct vma_struct
+{
+	void *start_address; //first page of the region
+	void *end_address; //end of the region, exclusive
+	int type; //TYPE_FILE, TYPE_ZERO or TYPE_STACK
+	bool writable; //determines if the region is writable
+	struct file *file; //the file of a TYPE_FILE region
+	off_t offset; //offset in the file of start_address
+	size_t read_bytes; //bytes of the file from start_address on, then zeros
+	int advice; //MADV_NORMAL, MADV_SEQUENTIAL or MADV_RANDOM
+	struct tree_elem elem; //for the thread's region tree
+};
+
+/********************************
+ * For Prefetch
+ */
+//a file page asked for with MADV_WILLNEED. The prefetch thread reads it into
+//a pinned frame of its own, which the owner maps on its next fault of the
+//page, so only the owner ever changes its page table.
+struct prefetch_struct
+{
+	struct thread *owner; //process the page is read for, NULL if cancelled
+	void *virtual_address; //the page
+	struct file *file; //reopened file the page comes from, kept open
+	unsigned write_cnt; //write_cnt of the file's inode when the page was read
+	off_t offset; //offset of the page in the file
+	size_t read_bytes; //bytes of the file, the rest of the page is zero
+	void *physical_address; //the frame once the page is read, else NULL
+	struct list_elem elem; //in the prefetch queue, then the owner's list
+};
+
 /********************************
  * For Frame
  */
 struct hash hash_frame;
 struct list hash_frame_list;
 
+//read-only executable frames, keyed by (inode sector, inode block), so that
+//every process running the same binary maps one copy of its text
+struct hash hash_share;
+
+//the read-only frame of zeros that never written zero pages are mapped to.
+//It is pinned, and never freed.
+void *zero_frame;
+
+//-rss: frames a process may map before it replaces its own pages, 0 if
+//unlimited. Fixed for a process when it starts.
+int vm_rss_limit;
+
+//-ksm: pages the merging thread scans per second, 0 if it does not run
+int vm_ksm_rate;
+
+//-evict: name of the page replacement policy, NULL for the default clock
+const char *vm_evict_name;
+
+//-swaps: comma separated names of the swap devices, NULL for the swap device
+const char *vm_swap_names;
+
 struct frame_struct
 {
 	void *physical_address; //Physical address of the frame
@@ -77,23 +172,35 @@ struct frame_struct
 	struct list_elem frame_list_elem; //list element for the frames list
 	struct lock page_list_lock; //page access is synchronized using
 	struct hash_elem hash_elem; //for hash frame table
+	block_sector_t share_inode; //inode sector of a shared text frame
+	off_t share_bid; //inode block of a shared text frame, -1 if private
+	struct hash_elem share_elem; //for the shared text table
+	uint8_t age; //aging: accessed bits of the last samples, newest on top
+	int64_t last_use; //wsclock: timer tick the frame was last seen accessed
+	bool hot; //2q: in the main queue rather than the FIFO one
+	unsigned ksm_pass; //ksm: the pass that last looked at the frame
 };
 
-/********************************
- * For Swap
- */
-struct block *swap_block;
-struct bitmap *swap_bitmap;
-size_t swap_size;
-
 /********************************
  * For Mmap
  */
 struct hash hash_mmap;
+
+//the reopened file of a mapping. A forked child inherits the mapping with
+//the same file, and shares its resident frames writable with the parent.
+//The last process to unmap it closes it.
+struct mmap_file
+{
+	struct file *file; //the reopened file
+	int user_cnt; //processes that map it, under the mmap lock
+};
+
 struct mmap_struct
 {
 	mapid_t mapid;
+	tid_t tid; //owning process, mapids are only unique per process
 	int fid; //file descriptor
+	struct mmap_file *mfile; //the mapped file, NULL if anonymous
 	struct hash_elem frame_hash_elem; //hash element for frame tables
 	struct list_elem thread_mmap_list; //for thread's mmap list
 	//a mapped file may span for multiple pages. This stores the start and end
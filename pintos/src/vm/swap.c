@@ -0,0 +1,170 @@
+#include "vm/struct.h"
+#include "threads/palloc.h"
+
+//swap devices -swaps may name
+#define SWAP_DEVS 4
+
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+//the swap area is made of page sized slots striped over the swap devices:
+//slot S is page S / swap_dev_cnt of device S % swap_dev_cnt. Slots are
+//handed out in turn, so pages swapped one after the other go to different
+//devices, and their I/O runs on different channels. The swap lock only
+//covers the slot bitmap, the I/O is done without it.
+struct swap_dev
+{
+	struct block *block; //the device
+	long long read_cnt; //pages read from it
+	long long write_cnt; //pages written to it
+};
+
+static struct swap_dev swap_devs[SWAP_DEVS];
+static size_t swap_dev_cnt;
+static struct bitmap *swap_slots; //slots in use
+static size_t swap_next; //where the search for a free slot starts
+
+static void swap_add(struct block *block);
+static struct swap_dev *slot_to_dev(size_t slot, block_sector_t *sector);
+
+//sets up the swap area over the devices named by -swaps, or else over the
+//swap device. Every device gives as many slots as the smallest one.
+void VM_swap_init(void)
+{
+	size_t pages = 0, i;
+
+	if (vm_swap_names == NULL)
+		swap_add(block_get_role(BLOCK_SWAP));
+	else
+	{
+		char names[64];
+		char *name, *save_ptr;
+
+		if (strlcpy(names, vm_swap_names, sizeof names) >= sizeof names)
+			PANIC("-swaps=%s: list of swap devices too long", vm_swap_names);
+		for (name = strtok_r(names, ",", &save_ptr); name != NULL;
+				name = strtok_r(NULL, ",", &save_ptr))
+		{
+			struct block *block = block_get_by_name(name);
+			if (block == NULL)
+				PANIC("swap device `%s' not found", name);
+			swap_add(block);
+		}
+	}
+
+	for (i = 0; i < swap_dev_cnt; i++)
+	{
+		size_t dev_pages = block_size(swap_devs[i].block) / SECTORS_PER_PAGE;
+		if (i == 0 || dev_pages < pages)
+			pages = dev_pages;
+	}
+	swap_slots = bitmap_create(pages * swap_dev_cnt);
+	if (swap_slots == NULL)
+		PANIC("no memory for the swap bitmap");
+}
+
+static void swap_add(struct block *block)
+{
+	if (block == NULL)
+		return;
+	if (swap_dev_cnt == SWAP_DEVS)
+		PANIC("more than %d swap devices", SWAP_DEVS);
+	swap_devs[swap_dev_cnt].block = block;
+	swap_devs[swap_dev_cnt].read_cnt = swap_devs[swap_dev_cnt].write_cnt = 0;
+	swap_dev_cnt++;
+}
+
+//returns the device of SLOT, and its first sector there in SECTOR
+static struct swap_dev *slot_to_dev(size_t slot, block_sector_t *sector)
+{
+	ASSERT(slot < bitmap_size(swap_slots));
+	*sector = slot / swap_dev_cnt * SECTORS_PER_PAGE;
+	return &swap_devs[slot % swap_dev_cnt];
+}
+
+//returns a free slot, or BITMAP_ERROR if swap is full
+size_t VM_swap_alloc(void)
+{
+	size_t slot;
+
+	lock_acquire(&l[LOCK_SWAP]);
+	slot = bitmap_scan_and_flip(swap_slots, swap_next, 1, false);
+	if (slot == BITMAP_ERROR)
+		slot = bitmap_scan_and_flip(swap_slots, 0, 1, false);
+	if (slot != BITMAP_ERROR)
+		swap_next = slot + 1;
+	lock_release(&l[LOCK_SWAP]);
+	return slot;
+}
+
+void VM_swap_free(size_t slot)
+{
+	VM_swap_free_multiple(&slot, 1);
+}
+
+//frees the CNT slots in SLOTS under one acquisition of the swap lock
+void VM_swap_free_multiple(const size_t *slots, size_t cnt)
+{
+	size_t i;
+
+	lock_acquire(&l[LOCK_SWAP]);
+	for (i = 0; i < cnt; i++)
+	{
+		if (!bitmap_test(swap_slots, slots[i]))
+			PANIC("Problem when freeing swap -- slot %zu", slots[i]);
+		bitmap_reset(swap_slots, slots[i]);
+	}
+	lock_release(&l[LOCK_SWAP]);
+}
+
+//reads the page in SLOT into KPAGE
+void VM_swap_read(size_t slot, void *kpage)
+{
+	block_sector_t sector;
+	struct swap_dev *dev = slot_to_dev(slot, &sector);
+	int i;
+
+	for (i = 0; i < SECTORS_PER_PAGE; i++)
+		block_read(dev->block, sector + i, kpage + i * BLOCK_SECTOR_SIZE);
+	dev->read_cnt++;
+}
+
+//writes the page at KPAGE to SLOT
+void VM_swap_write(size_t slot, const void *kpage)
+{
+	block_sector_t sector;
+	struct swap_dev *dev = slot_to_dev(slot, &sector);
+	int i;
+
+	for (i = 0; i < SECTORS_PER_PAGE; i++)
+		block_write(dev->block, sector + i, kpage + i * BLOCK_SECTOR_SIZE);
+	dev->write_cnt++;
+}
+
+//copies the page in SLOT to a new slot. Returns the new slot, or
+//BITMAP_ERROR if swap or memory is full.
+size_t VM_swap_duplicate(size_t slot)
+{
+	void *buffer = palloc_get_page(0);
+	size_t copy;
+
+	if (buffer == NULL)
+		return BITMAP_ERROR;
+	copy = VM_swap_alloc();
+	if (copy != BITMAP_ERROR)
+	{
+		VM_swap_read(slot, buffer);
+		VM_swap_write(copy, buffer);
+	}
+	palloc_free_page(buffer);
+	return copy;
+}
+
+void VM_print_swap_stats(void)
+{
+	size_t i;
+
+	for (i = 0; i < swap_dev_cnt; i++)
+		printf("VM: swap device %s: %lld pages read, %lld written\n",
+				block_name(swap_devs[i].block), swap_devs[i].read_cnt,
+				swap_devs[i].write_cnt);
+}
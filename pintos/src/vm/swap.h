@@ -0,0 +1,15 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stddef.h>
+
+void VM_swap_init(void);
+size_t VM_swap_alloc(void);
+void VM_swap_free(size_t slot);
+void VM_swap_free_multiple(const size_t *slots, size_t cnt);
+void VM_swap_read(size_t slot, void *kpage);
+void VM_swap_write(size_t slot, const void *kpage);
+size_t VM_swap_duplicate(size_t slot);
+void VM_print_swap_stats(void);
+
+#endif
@@ -0,0 +1,161 @@
+#include "vm/struct.h"
+#include "filesys/inode.h"
+
+//adds the region [START, END) of TYPE to the current process. Its pages are
+//only given a page_struct when they are first touched. A TYPE_FILE region
+//holds READ_BYTES of FILE from OFFSET on, followed by zeros.
+//Returns NULL if the region overlaps another one.
+struct vma_struct *VM_vma_add(void *start, void *end, int type, bool writable,
+		struct file *file, off_t offset, size_t read_bytes)
+{
+	struct vma_struct *vma;
+
+	ASSERT(pg_ofs(start) == 0 && pg_ofs(end) == 0);
+	if (start >= end || VM_vma_overlaps(start, end))
+		return NULL;
+
+	vma = (struct vma_struct *) malloc(sizeof(struct vma_struct));
+	if (vma != NULL)
+	{
+		vma->start_address = start;
+		vma->end_address = end;
+		vma->type = type;
+		vma->writable = writable;
+		vma->file = file;
+		vma->offset = offset;
+		vma->read_bytes = read_bytes;
+		vma->advice = MADV_NORMAL;
+		tree_insert(&thread_current()->vmas, &vma->elem);
+	}
+	return vma;
+}
+
+//returns the region of the current process that contains ADDRESS, or NULL
+struct vma_struct *VM_vma_find(const void *address)
+{
+	struct vma_struct key;
+	struct vma_struct *vma;
+	struct tree_elem *e;
+
+	key.start_address = (void *) address;
+	e = tree_floor(&thread_current()->vmas, &key.elem);
+	if (e == NULL)
+		return NULL;
+	vma = tree_entry(e, struct vma_struct, elem);
+	if (address >= vma->end_address)
+		return NULL;
+	return vma;
+}
+
+//returns true if [START, END) overlaps a region of the current process
+bool VM_vma_overlaps(void *start, void *end)
+{
+	struct tree *vmas = &thread_current()->vmas;
+	struct vma_struct key;
+	struct tree_elem *e;
+
+	//the region starting at or below START, then the one after it
+	key.start_address = start;
+	e = tree_floor(vmas, &key.elem);
+	if (e != NULL
+			&& tree_entry(e, struct vma_struct, elem)->end_address > start)
+		return true;
+	e = e != NULL ? tree_next(e) : tree_first(vmas);
+	return e != NULL
+			&& tree_entry(e, struct vma_struct, elem)->start_address < end;
+}
+
+//removes the region VMA of the current process. Pages already created for
+//it are left to the caller.
+void VM_vma_remove(struct vma_struct *vma)
+{
+	tree_remove(&thread_current()->vmas, &vma->elem);
+	free(vma);
+}
+
+//creates the page_struct of UPAGE from the region of the current process
+//that contains it. Returns NULL if there is none, and for the stack, which
+//only grows through the stack pointer check.
+struct page_struct *VM_vma_page(void *upage)
+{
+	struct vma_struct *vma = VM_vma_find(upage);
+	size_t skip, read_bytes = 0;
+	off_t ofs, bid = -1;
+
+	if (vma == NULL || vma->type == TYPE_STACK)
+		return NULL;
+
+	skip = upage - vma->start_address;
+	if (vma->type == TYPE_FILE && skip < vma->read_bytes)
+		read_bytes = vma->read_bytes - skip;
+	if (read_bytes > PGSIZE)
+		read_bytes = PGSIZE;
+	if (read_bytes == 0)
+		return VM_new_page(TYPE_ZERO, upage, vma->writable, NULL, 0, 0, 0, 0);
+
+	//read-only text is shared between processes by its inode block
+	ofs = vma->offset + skip;
+	if (!vma->writable)
+		bid = byte_to_sector(file_get_inode(vma->file), ofs);
+	return VM_new_page(TYPE_FILE, upage, vma->writable, vma->file, ofs,
+			read_bytes, PGSIZE - read_bytes, bid);
+}
+
+//removes all regions of the current process
+void VM_vma_destroy(void)
+{
+	struct tree *vmas = &thread_current()->vmas;
+
+	while (!tree_empty(vmas))
+		VM_vma_remove(tree_entry(tree_first(vmas), struct vma_struct, elem));
+}
+
+//moves the break of the current process by INCREMENT bytes. The heap is a
+//TYPE_ZERO region from heap_start up to the break, rounded up to a page, and
+//the pages it loses are freed. Returns the old break, or (void *) -1 if the
+//break would go below heap_start or the heap would run into another region.
+void *VM_sbrk(intptr_t increment)
+{
+	struct thread *t = thread_current();
+	uint8_t *old_brk = t->brk, *new_brk = old_brk + increment;
+	void *old_end = pg_round_up(old_brk), *new_end = pg_round_up(new_brk);
+	struct vma_struct *heap = NULL;
+
+	if ((increment > 0 && new_brk < old_brk)
+			|| (increment < 0 && new_brk > old_brk)
+			|| new_brk < (uint8_t *) t->heap_start
+			|| new_brk > (uint8_t *) PHYS_BASE)
+		return (void *) -1;
+
+	if (old_end > t->heap_start)
+		heap = VM_vma_find(t->heap_start);
+	if (new_end > old_end)
+	{
+		if (VM_vma_overlaps(old_end, new_end))
+			return (void *) -1;
+		if (heap != NULL)
+			heap->end_address = new_end;
+		else if (VM_vma_add(t->heap_start, new_end, TYPE_ZERO, true, NULL, 0, 0)
+				== NULL)
+			return (void *) -1;
+	}
+	else if (new_end < old_end)
+	{
+		VM_unmap_range(new_end, old_end);
+		if (new_end == t->heap_start)
+			VM_vma_remove(heap);
+		else
+			heap->end_address = new_end;
+	}
+	t->brk = new_brk;
+	return old_brk;
+}
+
+bool vma_less_helper(const struct tree_elem *a_, const struct tree_elem *b_,
+		void *aux UNUSED)
+{
+	const struct vma_struct *a = tree_entry(a_, struct vma_struct, elem);
+	const struct vma_struct *b = tree_entry(b_, struct vma_struct, elem);
+
+	return a->start_address < b->start_address;
+}
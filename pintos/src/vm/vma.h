@@ -0,0 +1,23 @@
+#ifndef VM_VMA_H
+#define VM_VMA_H
+
+#include "vm/struct.h"
+#include <tree.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/file.h"
+
+struct vma_struct *VM_vma_add(void *start, void *end, int type, bool writable,
+		struct file *file, off_t offset, size_t read_bytes);
+struct vma_struct *VM_vma_find(const void *address);
+bool VM_vma_overlaps(void *start, void *end);
+void VM_vma_remove(struct vma_struct *vma);
+struct page_struct *VM_vma_page(void *upage);
+void VM_vma_destroy(void);
+void *VM_sbrk(intptr_t increment);
+
+bool vma_less_helper(const struct tree_elem *a_, const struct tree_elem *b_,
+		void *aux);
+
+#endif